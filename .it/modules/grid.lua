@@ -0,0 +1,30 @@
+---[API] The grid module of the scripting api. Used to send state updates only to clients near a position.
+---Clients are placed in the grid by reporting their positions, and leave it when they disconnect.
+---Positions and radii must be finite numbers within single precision range, anything else raises an error.
+net.grid = {}
+
+---[API] Place a client in the grid by uuid or handle, or move it to a new position.
+---@param uuid string|integer
+---@param x number
+---@param y number
+net.grid.move = function(uuid, x, y)end
+
+---[API] Take a client out of the grid by uuid or handle, it will stop receiving grid broadcasts.
+---@param uuid string|integer
+net.grid.remove = function(uuid)end
+
+---[API] Send a packet to every client within a radius of a position, over TCP.
+---@param x number
+---@param y number
+---@param type string
+---@param packet table
+---@param radius? number Defaults to `net.config.interest_radius`.
+net.grid.broadcast_tcp = function(x, y, type, packet, radius)end
+
+---[API] Send a packet to every client within a radius of a position, over UDP.
+---@param x number
+---@param y number
+---@param type string
+---@param packet table
+---@param radius? number Defaults to `net.config.interest_radius`.
+net.grid.broadcast_udp = function(x, y, type, packet, radius)end
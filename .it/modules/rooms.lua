@@ -0,0 +1,29 @@
+---[API] The rooms module of the scripting api. Used to broadcast packets to a group of clients instead of everyone.
+---Rooms are created by the first join and removed once their last member leaves or disconnects.
+net.rooms = {}
+
+---[API] Add a client to a room by uuid or handle. Returns false if it already was a member.
+---@param uuid string|integer
+---@param room string
+---@return boolean joined
+---@diagnostic disable-next-line: missing-return
+net.rooms.join = function(uuid, room)end
+
+---[API] Remove a client from a room by uuid or handle. Returns false if it wasn't a member.
+---@param uuid string|integer
+---@param room string
+---@return boolean left
+---@diagnostic disable-next-line: missing-return
+net.rooms.leave = function(uuid, room)end
+
+---[API] Send a packet to every client in a room, over TCP.
+---@param room string
+---@param type string
+---@param packet table
+net.rooms.broadcast_tcp = function(room, type, packet)end
+
+---[API] Send a packet to every client in a room, over UDP.
+---@param room string
+---@param type string
+---@param packet table
+net.rooms.broadcast_udp = function(room, type, packet)end
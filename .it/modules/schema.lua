@@ -0,0 +1,12 @@
+---[API] The schema module of the scripting api. Used to send the hottest event types in a fixed layout without any names.
+---Once verified, clients receive a `schema` packet per schema after the symbols, holding the event type in its `schema` variable and each field's type (u8) under the field's name.
+---Clients that answer with a `symbols_ack` packet are sent intermediates that match a schema as a single schema control byte followed by the values, others keep receiving variables.
+---Fields are laid out in order of their names, packed without padding. Clients may send schema frames whether they acknowledged or not.
+net.schema = {}
+
+---[API] Declare the fields of an event type, mapping each name to a numeric type: s8, s16, s32, s64, u8, u16, u32, u64, f16, f32 or f64.
+---Tables sent with this type convert fields to their declared type, and missing fields are sent as 0.
+---Intermediates with any other variables are sent as usual. Schemas can only be defined while scripts load.
+---@param type string
+---@param fields table<string, string>
+net.schema.define = function(type, fields)end
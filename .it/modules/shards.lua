@@ -0,0 +1,33 @@
+---[API] The shards module of the scripting api. Used to talk between scripting shards, see `net.config.script_shards`.
+---Every shard is a separate Lua state running every script, so shards share no Lua values and only talk through messages.
+---A message is handled by the receiving shard's `net.messages[type]`, called with the message's fields plus `type` and `shard`, the shard it came from.
+---Messages arrive in the order they were sent, once the sender's current event has returned and the receiving shard is free.
+net.shards = {}
+
+---[API] Get the amount of shards.
+---@return integer count
+---@diagnostic disable-next-line: missing-return
+net.shards.count = function()end
+
+---[API] Get the shard this script is running on, from 0 up to `net.shards.count()`.
+---@return integer shard
+---@diagnostic disable-next-line: missing-return
+net.shards.current = function()end
+
+---[API] Get the shard a client's events run on by uuid or handle, or nil if it isn't connected.
+---@param uuid string|integer
+---@return integer|nil shard
+---@diagnostic disable-next-line: missing-return
+net.shards.of = function(uuid)end
+
+---[API] Send a message to a shard, including the current one. Messages can't be sent while scripts load.
+---Fields are carried like packet variables, so only numbers, strings, booleans and `net.arrays` arrays arrive.
+---@param shard integer
+---@param type string
+---@param message table
+net.shards.send = function(shard, type, message)end
+
+---[API] Send a message to every other shard.
+---@param type string
+---@param message table
+net.shards.broadcast = function(type, message)end
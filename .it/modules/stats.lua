@@ -0,0 +1,18 @@
+---[API] The stats module of the scripting api. Used to read the server's internal counters, e.g. for tuning limits.
+net.stats = {}
+
+---[API] Get a snapshot of the server's counters.
+---`rate_limited` is the total amount of events over a rate limit, `rate_limited_events` the same for each type in `net.config.rate_limits`
+---with every other type counted under `other`.
+---`send_dropped`, `send_conflated` and `slow_disconnects` count what happened to packets for clients with full queues.
+---`udp_dropped` counts datagrams dropped because too many from the same client were waiting to be dispatched.
+---`bundles` counts bundles sent to clients and `bundled` the packets that went out inside them.
+---`reliable_sent` counts packets sent with `net.packets.send_reliable` and `reliable_retransmitted` every time one was sent again.
+---`delta_packets` counts packets sent through delta encoding and `delta_saved` the bytes it left out.
+---`compressed` counts compressed packets, `compress_in` and `compress_out` the bytes of every frame considered before and after.
+---`compression_ratio` is out over in and `compression_ns_per_byte` the time spent compressing per byte considered.
+---`ticks` and `tick_overruns` count ticks and the ticks that ran past their deadline.
+---`tick_time` is how long the latest tick took and `tick_overrun` how late the latest overrun finished, both in milliseconds.
+---@return table stats
+---@diagnostic disable-next-line: missing-return
+net.stats.get = function()end
@@ -0,0 +1,13 @@
+---[API] The symbols module of the scripting api. Used to shorten event variable names on the wire.
+---Once verified, clients receive a `symbols` packet mapping each name to its symbol (u16).
+---Clients that answer with a `symbols_ack` packet are sent symbol coded variables, schema frames and bundles from then on, others keep receiving names.
+---A symbol coded variable replaces the name with its symbol, one byte below 128 and two with the high bit set otherwise.
+---Clients may send symbol coded variables whether they acknowledged or not.
+net.symbols = {}
+
+---[API] Give names symbols, returning the symbol of each. Names that already have one keep it.
+---Symbols can only be defined while scripts load.
+---@param ... string
+---@return integer ...
+---@diagnostic disable-next-line: missing-return
+net.symbols.define = function(...)end
@@ -0,0 +1,82 @@
+// Frame validation timings for intermediate_view_from_buffer and intermediate_frame_length.
+// Build it against the sources it measures, optimized, for example with
+//
+//   gcc -O2 -std=gnu2x bench/intermediate.c src/api/intermediate.c src/api/schema.c
+//       src/data/arena.c src/data/crypto.c src/data/hashtable.c src/data/mutex.c
+//       src/data/result.c -lbcrypt -o intermediate_bench
+//
+// and compare its output between revisions. Each case prints the fastest of its runs.
+#include "../src/api/intermediate.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_ITERATIONS 200000
+#define BENCH_RUNS 15
+
+static double bench_now(void) {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static void bench(const char *label, intermediate_t *intermediate) {
+    int len;
+    char *buffer = intermediate_to_buffer(intermediate, &len);
+
+    // A frame at the head of a full receive buffer, as intermediate_frame_length sees them
+    static char ring[MAX_INTERMEDIATE_SIZE];
+    memset(ring, 1, sizeof(ring));
+    memcpy(ring, buffer, len);
+
+    volatile int sink = 0;
+    double view = 1e9, frame = 1e9;
+    for (int run = 0; run < BENCH_RUNS; ++run) {
+        intermediate_view_t out;
+        double start = bench_now();
+        for (int i = 0; i < BENCH_ITERATIONS; ++i)
+            sink += intermediate_view_from_buffer(buffer, len, &out).is_ok;
+        double elapsed = (bench_now() - start) / BENCH_ITERATIONS;
+        view = elapsed < view ? elapsed : view;
+
+        start = bench_now();
+        for (int i = 0; i < BENCH_ITERATIONS; ++i)
+            sink += intermediate_frame_length(ring, sizeof(ring));
+        elapsed = (bench_now() - start) / BENCH_ITERATIONS;
+        frame = elapsed < frame ? elapsed : frame;
+    }
+
+    printf("%-18s %4d bytes  view %6.1f ns  frame_length %6.1f ns\n", label, len, view, frame);
+    free(buffer);
+    intermediate_delete(intermediate);
+}
+
+int main(void) {
+    float coordinate = 1.5f;
+    intermediate_t *position = intermediate_new("pos", 0);
+    intermediate_add_var(position, "x", INTERMEDIATE_F32, &coordinate, sizeof(float));
+    intermediate_add_var(position, "y", INTERMEDIATE_F32, &coordinate, sizeof(float));
+    intermediate_add_var(position, "z", INTERMEDIATE_F32, &coordinate, sizeof(float));
+    bench("pos 3 floats", position);
+
+    intermediate_t *chat = intermediate_new("chat", 0);
+    intermediate_add_var(chat, "channel", INTERMEDIATE_STRING, "general", 8);
+    intermediate_add_var(chat, "message", INTERMEDIATE_STRING, "hello there, how is everyone doing today?", 42);
+    bench("chat 2 strings", chat);
+
+    intermediate_t *profile = intermediate_new("profile", 0);
+    char name[32];
+    for (int i = 0; i < 6; ++i) {
+        sprintf(name, "field_%d", i);
+        intermediate_add_var(profile, name, INTERMEDIATE_STRING, "some value", 11);
+    }
+    bench("profile 6 strings", profile);
+
+    intermediate_t *state = intermediate_new("inventory_state", 0);
+    for (int i = 0; i < 24; ++i) {
+        sprintf(name, "slot_%02d_item", i);
+        intermediate_add_var(state, name, INTERMEDIATE_STRING, "iron_sword", 11);
+    }
+    bench("state 24 strings", state);
+}
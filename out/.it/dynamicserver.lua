@@ -1,7 +1,13 @@
 ---[API] The main dynamicserver table containing all api components and modules.
 net = {
     ---[API] The table containing all events. You can add functions to this table named after an event to register new ones.
+    ---Breaking: handlers are never re-entered. An event raised while a handler runs, like the `disconnect` of a player kicked from it,
+    ---is queued and runs after the handler returns. It used to run inside the call, before it returned.
+    ---Handlers are cached by the server. Assigning to this table or replacing it is always seen, but it reads as empty to
+    ---`rawget` and `next`, so iterate it with `pairs` and don't `rawset` into it or `net`.
     events = {},
+    ---[API] The table containing message handlers. You can add functions to this table named after a message type to receive `net.shards` messages of it.
+    messages = {},
     ---[API] The table containing configuration for the server. You should modify this in `config.lua`
     config = {
         ---[CONFIG] The port the server's TCP socket should bind to.
@@ -10,7 +16,43 @@ net = {
         udp_port = 5060,
         ---[CONFIG] The max amount of players the server should allow to connect.
         max_players = 500,
+        ---[CONFIG] The amount of network worker threads, 0 uses one per logical processor.
+        workers = 0,
+        ---[CONFIG] The amount of UDP worker threads, each pinned to a core, 0 uses one per logical processor.
+        ---Events from a single client are still dispatched in the order they were received.
+        udp_workers = 0,
+        ---[CONFIG] The amount of ticks per second, each calls `net.events.tick(dt)` and then writes every client's queued packets at once.
+        ---0 disables ticking and packets are written as soon as they are sent.
+        tick_rate = 0,
+        ---[CONFIG] The size of a cell in the interest grid, roughly the interest radius works well.
+        grid_cell_size = 64,
+        ---[CONFIG] The default radius of `net.grid` broadcasts.
+        interest_radius = 128,
+        ---[CONFIG] The zstd level frames sent by the server are compressed at, 0 disables compression.
+        compression_level = 0,
+        ---[CONFIG] Frames smaller than this many bytes are always sent uncompressed.
+        compression_threshold = 128,
+        ---[CONFIG] Path to a zstd dictionary trained on captured frames, e.g. with `zstd --train`. Empty uses no dictionary.
+        ---Clients must decompress with the same dictionary.
+        compression_dictionary = "",
+        ---[CONFIG] The amount of events per second a client may send, 0 disables the limit.
+        rate_limit = 30,
+        ---[CONFIG] The amount of events a client may send in a burst above its rate.
+        rate_burst = 10,
+        ---[CONFIG] Event specific rates per second, keyed by event type, e.g. `{ position = 60 }`.
+        rate_limits = {},
+        ---[CONFIG] What happens to events over the limit, "drop" discards them and "defer" holds them until allowed.
+        rate_policy = "drop",
+        ---[CONFIG] The amount of packets that can wait to be sent to a single client.
+        send_queue = 256,
+        ---[CONFIG] What happens when a client's send queue is full, "drop" discards the new packet,
+        ---"conflate" replaces a queued packet of the same type and "disconnect" drops the client.
+        slow_policy = "drop",
+        ---[CONFIG] The amount of Lua states scripts run on, each loads every script and gets a share of the clients.
+        ---Shards run side by side and only talk through `net.shards` messages, `net.clients` only holds the shard's own clients.
+        script_shards = 1,
     },
-    ---[API] The table of all connected clients and their data. You can index this with a uuid (string) to access other clients' data.
+    ---[API] The table of the shard's connected clients and their data. You can index this with a uuid (string) to access other clients' data.
+    ---Every client also has a `handle` (integer), which is cheaper to pass to the api than its uuid and never refers to a later client.
     clients = {},
 }
\ No newline at end of file
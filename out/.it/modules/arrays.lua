@@ -0,0 +1,50 @@
+---[API] The arrays module of the scripting api. Used to send bulk numbers as a single variable instead of one per element.
+---An array is sent as its u8 element type, a u16 count and the elements packed back to back, and arrays received are passed to events the same way.
+---Strings end at their first NUL byte when sent, wrap them with `net.arrays.bytes` to send every byte as a u16 length followed by the data.
+---Bytes received are passed to events as strings.
+net.arrays = {}
+
+---[API] An array of fixed size numbers, indexed from 1. Reading past the end gives nil and writing past it is an error.
+---@class net.array
+---@field [integer] number
+local array = {}
+
+---[API] The elements as the raw bytes they are sent as.
+---@return string
+---@diagnostic disable-next-line: missing-return
+function array:to_string()end
+
+---[API] Copy the elements into a table.
+---@return number[]
+---@diagnostic disable-next-line: missing-return
+function array:to_table()end
+
+---[API] Raw data sent as bytes rather than a string, so it may hold NUL bytes. `#` gives its length.
+---@class net.bytes
+local bytes = {}
+
+---[API] The data as a string.
+---@return string
+---@diagnostic disable-next-line: missing-return
+function bytes:to_string()end
+
+---[API] Create an array of s8, s16, s32, s64, u8, u16, u32, u64, f16, f32 or f64 elements, from a table of numbers or as count zeroes.
+---Arrays hold at most 65535 elements, though frames over 1024 bytes are rejected when received.
+---@param type string
+---@param values number[]|integer
+---@return net.array
+---@diagnostic disable-next-line: missing-return
+net.arrays.new = function(type, values)end
+
+---[API] Create an array from the raw bytes of its elements, such as those of array:to_string() or string.pack.
+---@param type string
+---@param bytes string
+---@return net.array
+---@diagnostic disable-next-line: missing-return
+net.arrays.from_string = function(type, bytes)end
+
+---[API] Wrap a string of at most 65535 bytes to be sent as bytes, keeping any NUL bytes it holds.
+---@param data string
+---@return net.bytes
+---@diagnostic disable-next-line: missing-return
+net.arrays.bytes = function(data)end
@@ -1,19 +1,72 @@
 ---[API] The packets module of the scripting api. Used to manipulate and send/broadcast packets over the network.
+---Numbers are sent with whichever type takes the fewest bytes. Integers become fixed width or varint (zigzag when negative),
+---others f16 or fixed point when those hold them exactly, and f32 otherwise. Fields of a schema keep their declared type.
+---Arrays from net.arrays are sent as one variable and `net.arrays.bytes` as raw bytes. Strings end at their first NUL byte.
+---Clients that sent `symbols_ack` get packets queued together as bundles: a bundle control byte, the u16 length of the whole bundle,
+---the u8 count of frames and each frame after its u16 length. Ticking servers hold UDP packets to them until the end of the tick to share datagrams.
+---Clients may send bundles of up to 32 frames over TCP and UDP, over TCP each frame is rate limited on its own.
 net.packets = {}
 
----[API] Send a packet to a client by uuid, over TCP.
----@param uuid string
+---[API] Send a packet to a client by uuid or handle, over TCP.
+---@param uuid string|integer
 ---@param type string
 ---@param packet table
 net.packets.send_tcp = function(uuid, type, packet)end
 
----[API] Send a packet to a client by uuid, over UDP.
----@param uuid string
+---[API] Send a packet to a client by uuid or handle, over UDP.
+---@param uuid string|integer
 ---@param type string
 ---@param packet table
 net.packets.send_udp = function(uuid, type, packet)end
 
+---[API] Send a packet to a client by uuid or handle, over UDP, retransmitting it until it is acknowledged.
+---Ordered packets, the default, are dispatched by the receiver in the order they were sent, unordered ones as soon as they arrive.
+---Either way a lost packet only holds back later packets of its own lane, unlike TCP.
+---Each packet is wrapped in a reliable control byte, the u8 lane (0 ordered, 1 unordered) and a u16 sequence.
+---The receiver answers with an ack control byte, the lane, the sequence and a u32 whose bits mark the 32 sequences before it as received.
+---Clients can send reliable packets to the server the same way.
+---@param uuid string|integer
+---@param type string
+---@param packet table
+---@param ordered? boolean
+net.packets.send_reliable = function(uuid, type, packet, ordered)end
+
 ---[API] Send a reply packet to a client. Replies only use TCP.
 ---@param to table
 ---@param reply table
-net.packets.reply = function(to, reply)end
\ No newline at end of file
+net.packets.reply = function(to, reply)end
+
+---[API] Send a packet to every connected client, over TCP.
+---@param type string
+---@param packet table
+net.packets.broadcast_tcp = function(type, packet)end
+
+---[API] Send a packet to every connected client, over UDP.
+---@param type string
+---@param packet table
+net.packets.broadcast_udp = function(type, packet)end
+
+---[API] Send a state packet to a client by uuid or handle, over TCP, with only the variables that changed.
+---Deltas are encoded against the latest state of the same type the client acknowledged with a `delta_ack`
+---packet, which carries the acknowledged packet's id as `baseline` (any integer type) and its type as `event` (string).
+---A delta starts with a baseline control byte followed by the id of the state it is based on.
+---@param uuid string|integer
+---@param type string
+---@param packet table
+net.packets.send_delta_tcp = function(uuid, type, packet)end
+
+---[API] Send a state packet to a client by uuid or handle, over UDP, with only the variables that changed.
+---@param uuid string|integer
+---@param type string
+---@param packet table
+net.packets.send_delta_udp = function(uuid, type, packet)end
+
+---[API] Send a state packet to every connected client, over TCP, each with only the variables that changed for it.
+---@param type string
+---@param packet table
+net.packets.broadcast_delta_tcp = function(type, packet)end
+
+---[API] Send a state packet to every connected client, over UDP, each with only the variables that changed for it.
+---@param type string
+---@param packet table
+net.packets.broadcast_delta_udp = function(type, packet)end
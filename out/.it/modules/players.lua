@@ -1,7 +1,9 @@
 ---[API] The players module of the scripting api. Used to control and manipulate the state of players.
 net.players = {}
 
----[API] Kick a player with a reason.
----@param uuid string
+---[API] Kick a player with a reason, by uuid or handle.
+---Breaking: the player's `disconnect` event is queued and runs after the calling handler returns, not before `kick` does.
+---Until then the player is still in `net.clients`.
+---@param uuid string|integer
 ---@param reason string
 net.players.kick = function(uuid, reason)end
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "intermediate.h"
+#include "schema.h"
 #include "../util/win32.h"
 #include <float.h>
 #include <math.h>
@@ -7,7 +8,23 @@
 #include <stdlib.h>
 #include <string.h>
 
-const static char *INTERNAL_VARIABLES[] = {
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define INTERMEDIATE_SCAN_SSE2
+#endif
+
+/// Bytes of a frame scanned for terminators at a time, one bit each.
+#define INTERMEDIATE_SCAN_BLOCK 64
+
+/// Offset in a frame from which strings are found with its scan, memchr is quicker for those before.
+#ifdef INTERMEDIATE_SCAN_SSE2
+#define INTERMEDIATE_SCAN_FROM INTERMEDIATE_SCAN_BLOCK
+#else
+// Without SSE2 the scan never catches up with memchr
+#define INTERMEDIATE_SCAN_FROM MAX_INTERMEDIATE_SIZE
+#endif
+
+const char *INTERNAL_VARIABLES[] = {
     "client",
     "reply",
     "id",
@@ -25,6 +42,13 @@ intermediate_t *intermediate_new(char *event, uint32_t reply) {
 }
 
 void intermediate_delete(intermediate_t *self) {
+    // Decoded intermediates live in their arena, a shared one is left to be reset
+    if (self->arena) {
+        if (self->owns_arena)
+            arena_delete(self->arena);
+        return;
+    }
+
     intermediate_variable_t *var = self->variables;
     while (var) {
         free(var->name);
@@ -39,265 +63,877 @@ void intermediate_delete(intermediate_t *self) {
     free(self);
 }
 
-char *intermediate_to_buffer(intermediate_t *self, int *len) {
-    char *buffer, *head;
-    *len = sizeof(char) + sizeof(float) + sizeof(uint32_t) * 2 + strlen(self->type) + 2; // INTERMEDIATE_HEADER, header data, INTERMEDIATE_END
-    head = buffer = calloc(1, *len);
+intermediate_variable_t *intermediate_find_var(intermediate_t *self, const char *name) {
+    for (intermediate_variable_t *var = self->variables; var; var = var->next) {
+        if (strcmp(var->name, name) == 0)
+            return var;
+    }
+    return nullptr;
+}
 
-    *head = (char)INTERMEDIATE_HEADER;
-    head += sizeof(char);
+/// Length of a NUL terminated string at head including the terminator.
+/// Returns 0 if it isn't terminated within the buffer or -1 if it is too long.
+static int intermediate_string_length(const char *head, const char *end) {
+    uint64_t max = end - head < MAX_INTERMEDIATE_STRING_LENGTH + 1 ? end - head : MAX_INTERMEDIATE_STRING_LENGTH + 1;
+    const char *nul = memchr(head, '\0', max);
+    if (!nul)
+        return max > MAX_INTERMEDIATE_STRING_LENGTH ? -1 : 0;
+    return nul - head + 1;
+}
 
-    *(float *)head = INTERMEDIATE_VERSION;
-    head += sizeof(float);
+/// NUL positions in a frame being validated, found a block at a time as they are needed.
+/// Every byte past INTERMEDIATE_SCAN_FROM is compared once however many strings the frame holds.
+typedef struct intermediate_scan_t {
+    const char *buffer;
+    int len, blocks;
+    uint64_t nuls[MAX_INTERMEDIATE_SIZE / INTERMEDIATE_SCAN_BLOCK];
+} intermediate_scan_t;
 
-    *(uint32_t *)head = self->id;
-    head += sizeof(uint32_t);
-    *(uint32_t *)head = self->reply;
-    head += sizeof(uint32_t);
+static intermediate_scan_t intermediate_scan_new(const char *buffer, uint64_t len) {
+    // Blocks are always scanned before they are read, so nuls is left uninitialized
+    intermediate_scan_t scan;
+    scan.buffer = buffer;
+    scan.len = len < MAX_INTERMEDIATE_SIZE ? len : MAX_INTERMEDIATE_SIZE;
+    scan.blocks = 0;
+    return scan;
+}
 
-    strcpy(head, self->type);
-    head += strlen(self->type) + 1;
+/// Scan the frame's next block for NUL bytes, setting bit i if byte i of the block is one.
+static void intermediate_scan_block(intermediate_scan_t *self) {
+    const char *head = self->buffer + self->blocks * INTERMEDIATE_SCAN_BLOCK;
+    int size = self->len - self->blocks * INTERMEDIATE_SCAN_BLOCK;
+    size = size < INTERMEDIATE_SCAN_BLOCK ? size : INTERMEDIATE_SCAN_BLOCK;
+    uint64_t mask = 0;
+    int i = 0;
 
-    for (intermediate_variable_t *var = self->variables; var; var = var->next) {
-        bool internal = false;
-        for (unsigned long long i = 0; i < sizeof(INTERNAL_VARIABLES) / sizeof(const char *); ++i) {
-            if (strcmp(INTERNAL_VARIABLES[i], var->name) == 0) {
-                internal = true;
+#ifdef INTERMEDIATE_SCAN_SSE2
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(head + i));
+        mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, zero)) << i;
+    }
+    // The rest is covered by the last 16 bytes of the frame, dropping those already seen
+    if (i < size && self->len >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(head + size - 16));
+        uint64_t rest = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, zero));
+        mask |= rest >> (16 - (size - i)) << i;
+        i = size;
+    }
+#endif
+    for (; i < size; ++i) {
+        if (!head[i])
+            mask |= 1ULL << i;
+    }
+
+    self->nuls[self->blocks++] = mask;
+}
+
+/// intermediate_string_length for strings found with the frame's scan.
+__attribute__((noinline)) static int intermediate_scan_string_far(intermediate_scan_t *self, const char *head, const char *end) {
+    // Most strings end in the block they start in, which has usually been scanned already
+    uint32_t from = head - self->buffer, block = from / INTERMEDIATE_SCAN_BLOCK;
+    if (block < (uint32_t)self->blocks) {
+        uint64_t nuls = self->nuls[block] >> from % INTERMEDIATE_SCAN_BLOCK;
+        if (nuls && __builtin_ctzll(nuls) < end - head)
+            return __builtin_ctzll(nuls) + 1;
+    }
+
+    int max = end - head < MAX_INTERMEDIATE_STRING_LENGTH + 1 ? end - head : MAX_INTERMEDIATE_STRING_LENGTH + 1;
+    if (!max || (int)from + max > self->len)
+        return intermediate_string_length(head, end);
+
+    // Strings before INTERMEDIATE_SCAN_FROM were found with memchr, so the scan starts after them
+    if (!self->blocks)
+        self->blocks = block;
+    uint64_t nuls = ~0ULL << from % INTERMEDIATE_SCAN_BLOCK;
+    for (; block * INTERMEDIATE_SCAN_BLOCK < from + max; ++block, nuls = ~0ULL) {
+        while (block >= (uint32_t)self->blocks)
+            intermediate_scan_block(self);
+        if ((nuls &= self->nuls[block])) {
+            int len = block * INTERMEDIATE_SCAN_BLOCK + __builtin_ctzll(nuls) - from + 1;
+            if (len > max)
                 break;
-            }
+            return len;
         }
+    }
+    return max > MAX_INTERMEDIATE_STRING_LENGTH ? -1 : 0;
+}
 
-        if (internal)
-            continue;
+/// intermediate_string_length using the frame's scan.
+__attribute__((always_inline)) static inline int intermediate_scan_string(intermediate_scan_t *self, const char *head, const char *end) {
+    if (head - self->buffer < INTERMEDIATE_SCAN_FROM)
+        return intermediate_string_length(head, end);
+    return intermediate_scan_string_far(self, head, end);
+}
+
+/// Length of a varint at head.
+/// Returns 0 if it runs past end or -1 if it is longer than INTERMEDIATE_MAX_VARINT_SIZE.
+static int intermediate_varint_length(const char *head, const char *end) {
+    for (int len = 1; len <= INTERMEDIATE_MAX_VARINT_SIZE; ++len) {
+        if (head + len > end)
+            return 0;
+        if (!(head[len - 1] & 0x80))
+            return len;
+    }
+    return -1;
+}
 
-        *len += sizeof(char); // intermediate_control_e
-        *len += strlen(var->name) + 1;
-        *len += sizeof(char); // intermediate_type_e
+static int intermediate_varint_write(char *head, uint64_t value) {
+    int len = 0;
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        head[len++] = (char)(value ? byte | 0x80 : byte);
+    } while (value);
+    return len;
+}
 
-        int value_size;
-        switch (var->type) {
-            case INTERMEDIATE_STRING:
-                value_size = strlen(var->value) + 1;
-                break;
+/// Read a varint that was already validated.
+static uint64_t intermediate_varint_read(const char *head) {
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t byte = *head++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+}
 
-            case INTERMEDIATE_S8:
-            case INTERMEDIATE_U8:
-                value_size = sizeof(int8_t);
-                break;
+static uint64_t intermediate_zigzag_encode(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
 
-            case INTERMEDIATE_S16:
-            case INTERMEDIATE_U16:
-                value_size = sizeof(int16_t);
-                break;
+static int64_t intermediate_zigzag_decode(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
 
-            case INTERMEDIATE_S32:
-            case INTERMEDIATE_U32:
-            case INTERMEDIATE_F32:
-                value_size = sizeof(int32_t);
-                break;
+/// Round a float to half precision, to nearest even.
+static uint16_t intermediate_f16_from_float(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(float));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    int exponent = (int)((bits >> 23) & 0xFF);
 
-            case INTERMEDIATE_S64:
-            case INTERMEDIATE_U64:
-            case INTERMEDIATE_F64:
-                value_size = sizeof(int64_t);
-                break;
-        }
-        *len += value_size;
+    // Infinity and NaN
+    if (exponent == 0xFF)
+        return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+
+    exponent += 15 - 127;
+    if (exponent >= 0x1F)
+        return sign | 0x7C00;
+
+    // Subnormal, or too small for even that
+    uint32_t half, rest, halfway;
+    if (exponent <= 0) {
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        half = mantissa >> shift;
+        rest = mantissa & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+    } else {
+        half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+        rest = mantissa & 0x1FFF;
+        halfway = 0x1000;
+    }
+
+    // A carry out of the mantissa moves up the exponent, which is still correct
+    if (rest > halfway || (rest == halfway && (half & 1)))
+        half++;
+    return sign | half;
+}
+
+static float intermediate_f16_to_float(uint16_t half) {
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1F, mantissa = half & 0x3FF;
+
+    uint32_t bits;
+    if (exponent == 0x1F)
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    else if (exponent)
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    else
+        return sign ? -ldexpf(mantissa, -24) : ldexpf(mantissa, -24);
+
+    float value;
+    memcpy(&value, &bits, sizeof(float));
+    return value;
+}
+
+/// Size of a bytes or array value from its header, whose element type has been checked.
+static int intermediate_bulk_size(intermediate_type_e type, const char *head) {
+    uint16_t count;
+    if (type == INTERMEDIATE_BYTES) {
+        memcpy(&count, head, sizeof(uint16_t));
+        return INTERMEDIATE_BYTES_HEADER_SIZE + count;
+    }
+    memcpy(&count, head + sizeof(uint8_t), sizeof(uint16_t));
+    return INTERMEDIATE_ARRAY_HEADER_SIZE + count * intermediate_type_size((uint8_t)*head);
+}
+
+/// Length of a value at head.
+/// Returns 0 if it runs past end, or -1 if it is malformed or of an unknown type.
+static int intermediate_value_length(intermediate_type_e type, const char *head, const char *end) {
+    int size;
+    switch (type) {
+        case INTERMEDIATE_STRING:
+            return intermediate_string_length(head, end);
+
+        case INTERMEDIATE_BYTES:
+        case INTERMEDIATE_ARRAY:
+            if (end - head < (long long)(type == INTERMEDIATE_BYTES ? INTERMEDIATE_BYTES_HEADER_SIZE : INTERMEDIATE_ARRAY_HEADER_SIZE))
+                return 0;
+            // Arrays only hold fixed size numbers
+            if (type == INTERMEDIATE_ARRAY && intermediate_type_size((uint8_t)*head) <= 0)
+                return -1;
+            size = intermediate_bulk_size(type, head);
+            return end - head < size ? 0 : size;
+
+        case INTERMEDIATE_VARINT:
+        case INTERMEDIATE_ZIGZAG:
+            return intermediate_varint_length(head, end);
+
+        case INTERMEDIATE_FIXED:
+            if (head >= end)
+                return 0;
+            if ((uint8_t)*head > INTERMEDIATE_MAX_FIXED_PLACES)
+                return -1;
+            size = intermediate_varint_length(head + 1, end);
+            return size > 0 ? size + 1 : size;
+
+        default:
+            if ((size = intermediate_type_size(type)) < 0)
+                return -1;
+            return end - head < size ? 0 : size;
+    }
+}
+
+/// intermediate_value_length using the frame's scan for strings.
+__attribute__((always_inline)) static inline int intermediate_scan_value(intermediate_scan_t *self, intermediate_type_e type, const char *head, const char *end) {
+    if (type == INTERMEDIATE_STRING)
+        return intermediate_scan_string(self, head, end);
+    return intermediate_value_length(type, head, end);
+}
+
+/// Size of a variable's value on the wire.
+static int intermediate_value_size(intermediate_variable_t *var) {
+    if (var->type == INTERMEDIATE_STRING)
+        return (int)strlen(var->value) + 1;
+    if (var->type == INTERMEDIATE_BYTES || var->type == INTERMEDIATE_ARRAY)
+        return intermediate_bulk_size(var->type, var->value);
+    // Numbers never take more than this, so the bound only stops reading past a malformed value
+    return intermediate_value_length(var->type, var->value, (const char *)var->value + INTERMEDIATE_MAX_NUMBER_SIZE);
+}
+
+bool intermediate_is_internal(const char *name) {
+    for (unsigned long long i = 0; i < sizeof(INTERNAL_VARIABLES) / sizeof(const char *); ++i) {
+        if (strcmp(INTERNAL_VARIABLES[i], name) == 0)
+            return true;
+    }
+    return false;
+}
+
+/// Write a symbol in one byte below 0x80, or two with the high bit of the first set.
+/// Returns how many bytes it took.
+static int intermediate_symbol_write(char *head, uint32_t symbol) {
+    if (symbol < 0x80) {
+        *head = (char)symbol;
+        return 1;
+    }
+    head[0] = (char)(0x80 | (symbol >> 8));
+    head[1] = (char)(symbol & 0xFF);
+    return 2;
+}
+
+/// Read a symbol written by intermediate_symbol_write.
+/// Returns how many bytes it took, or 0 if it runs past end.
+static int intermediate_symbol_read(const char *head, const char *end, uint32_t *symbol) {
+    if (head >= end)
+        return 0;
+    if (!(*head & 0x80)) {
+        *symbol = (uint8_t)*head;
+        return 1;
+    }
+    if (end - head < 2)
+        return 0;
+    *symbol = ((uint32_t)(head[0] & 0x7F) << 8) | (uint8_t)head[1];
+    return 2;
+}
+
+/// Whether an intermediate has exactly the variables of a schema, with the same types.
+static bool intermediate_fits_schema(intermediate_t *self, const schema_t *schema) {
+    // One bit per field, at most SCHEMA_MAX_FIELDS of them, so a repeated name can't stand in for a missing field
+    uint64_t seen = 0;
+    uint32_t count = 0;
+    for (intermediate_variable_t *var = self->variables; var; var = var->next) {
+        if (var->internal)
+            continue;
+        const schema_field_t *field = schema_field(schema, var->name);
+        if (!field || field->type != var->type)
+            return false;
+        uint64_t bit = 1ull << (field - schema->fields);
+        if (seen & bit)
+            return false;
+        seen |= bit;
+        count++;
+    }
+    return count == schema->field_count;
+}
 
-        // Realloc and write
-        int prog = head - buffer;
-        buffer = realloc(buffer, *len);
-        head = buffer + prog;
+/// Encode an intermediate in one pass, leaving out variables equal to those in the baseline if there is one.
+/// Names are sent as their symbols if symbols is set and they have one.
+/// Returns the length, or -1 if it needs more than capacity bytes.
+/// saved receives the bytes left out compared to a full encoding.
+static int intermediate_encode(intermediate_t *self, intermediate_t *baseline, uint32_t baseline_id, bool symbols, char *buffer, int capacity, int *saved) {
+    char *head = buffer, *end = buffer + capacity;
+    int type_len = strlen(self->type) + 1;
+    *saved = 0;
 
-        *head = (char)INTERMEDIATE_VARIABLE;
+    // INTERMEDIATE_HEADER, header data, INTERMEDIATE_END
+    if (end - head < (long long)(INTERMEDIATE_TYPE_OFFSET + type_len + sizeof(char)))
+        return -1;
+
+    *head = (char)INTERMEDIATE_HEADER;
+    head += sizeof(char);
+    float version = INTERMEDIATE_VERSION;
+    memcpy(head, &version, sizeof(float));
+    head += sizeof(float);
+    memcpy(head, &self->id, sizeof(uint32_t));
+    head += sizeof(uint32_t);
+    memcpy(head, &self->reply, sizeof(uint32_t));
+    head += sizeof(uint32_t);
+    memcpy(head, self->type, type_len);
+    head += type_len;
+
+    if (baseline) {
+        if (end - head < (long long)(sizeof(char) * 2 + sizeof(uint32_t)))
+            return -1;
+        *head = (char)INTERMEDIATE_BASELINE;
+        head += sizeof(char);
+        memcpy(head, &baseline_id, sizeof(uint32_t));
+        head += sizeof(uint32_t);
+        *saved -= sizeof(char) + sizeof(uint32_t);
+    }
+
+    // Values are written straight to their offsets, without names or types
+    const schema_t *schema = symbols && !baseline ? schema_find(self->type) : nullptr;
+    if (schema && intermediate_fits_schema(self, schema)) {
+        if (end - head < (long long)(sizeof(char) * 2 + schema->size))
+            return -1;
+        *head = (char)INTERMEDIATE_SCHEMA;
         head += sizeof(char);
+        memset(head, 0, schema->size);
+        for (intermediate_variable_t *var = self->variables; var; var = var->next) {
+            if (!var->internal)
+                memcpy(head + schema_field(schema, var->name)->offset, var->value, intermediate_type_size(var->type));
+        }
+        head += schema->size;
+        *head = (char)INTERMEDIATE_END;
+        return head + sizeof(char) - buffer;
+    }
+
+    for (intermediate_variable_t *var = self->variables; var; var = var->next) {
+        if (var->internal)
+            continue;
+
+        bool symbol = symbols && var->symbol >= 0;
+        int name_len = symbol ? (var->symbol < 0x80 ? 1 : 2) : (int)strlen(var->name) + 1;
+        int value_size = intermediate_value_size(var);
+        if (value_size < 0)
+            continue;
 
-        strcpy(head, var->name);
-        head += strlen(head) + 1;
+        // Unchanged since the baseline
+        intermediate_variable_t *base = baseline ? intermediate_find_var(baseline, var->name) : nullptr;
+        if (base && base->type == var->type && intermediate_value_size(base) == value_size
+            && memcmp(base->value, var->value, value_size) == 0) {
+            *saved += sizeof(char) * 2 + name_len + value_size;
+            continue;
+        }
 
+        // Control byte, name, type, value, and room left for INTERMEDIATE_END
+        if (end - head < (long long)(sizeof(char) * 3 + name_len + value_size))
+            return -1;
+
+        *head = (char)(symbol ? INTERMEDIATE_SYMBOL_VARIABLE : INTERMEDIATE_VARIABLE);
+        head += sizeof(char);
+        if (symbol)
+            intermediate_symbol_write(head, var->symbol);
+        else
+            memcpy(head, var->name, name_len);
+        head += name_len;
         *head = (char)var->type;
         head += sizeof(char);
-
         memcpy(head, var->value, value_size);
         head += value_size;
     }
 
-    buffer[*len - 1] = INTERMEDIATE_END;
+    *head = (char)INTERMEDIATE_END;
+    head += sizeof(char);
+
+    return head - buffer;
+}
 
+/// Encode into the calling thread's scratch buffer, which only grows for intermediates larger than any before.
+static const char *intermediate_encode_scratch(intermediate_t *self, intermediate_t *baseline, uint32_t baseline_id, bool symbols, int *len, int *saved) {
+    static thread_local char *scratch;
+    static thread_local int capacity;
+    if (!scratch) {
+        capacity = MAX_INTERMEDIATE_SIZE;
+        scratch = malloc(capacity);
+    }
+
+    while ((*len = intermediate_encode(self, baseline, baseline_id, symbols, scratch, capacity, saved)) < 0) {
+        capacity *= 2;
+        scratch = realloc(scratch, capacity);
+    }
+    return scratch;
+}
+
+int intermediate_write(intermediate_t *self, char *buffer, int capacity) {
+    int saved;
+    return intermediate_encode(self, nullptr, 0, false, buffer, capacity, &saved);
+}
+
+const char *intermediate_to_scratch(intermediate_t *self, bool symbols, int *len) {
+    int saved;
+    return intermediate_encode_scratch(self, nullptr, 0, symbols, len, &saved);
+}
+
+char *intermediate_to_buffer(intermediate_t *self, int *len) {
+    const char *scratch = intermediate_to_scratch(self, false, len);
+    char *buffer = malloc(*len);
+    memcpy(buffer, scratch, *len);
     return buffer;
 }
 
+const char *intermediate_to_delta(intermediate_t *self, intermediate_t *baseline, uint32_t baseline_id, bool symbols, int *len, int *saved) {
+    // Deltas can only add or change variables, anything removed needs a full intermediate
+    for (intermediate_variable_t *var = baseline ? baseline->variables : nullptr; var; var = var->next) {
+        if (!intermediate_find_var(self, var->name))
+            return intermediate_encode_scratch(self, nullptr, 0, symbols, len, saved);
+    }
+    return intermediate_encode_scratch(self, baseline, baseline_id, symbols, len, saved);
+}
+
+intermediate_t *intermediate_copy(intermediate_t *self) {
+    intermediate_t *copy = intermediate_new(self->type, self->reply);
+    copy->id = self->id;
+    copy->version = self->version;
+
+    // Variables are prepended, so walking in order would reverse them
+    intermediate_variable_t **tail = &copy->variables;
+    for (intermediate_variable_t *var = self->variables; var; var = var->next) {
+        intermediate_variable_t *v = calloc(1, sizeof(intermediate_variable_t));
+        v->name = _strdup(var->name);
+        v->type = var->type;
+        v->internal = var->internal;
+        v->symbol = var->symbol;
+        v->value = malloc(intermediate_value_size(var));
+        memcpy(v->value, var->value, intermediate_value_size(var));
+        *tail = v;
+        tail = &v->next;
+    }
+
+    return copy;
+}
+
+uint64_t intermediate_arena_size(int len) {
+    // Every variable takes at least a control byte, a name terminator and a type on the wire,
+    // apart from those of a schema, and its three allocations lose at most an alignment's worth each
+    uint64_t variables = len / 3 + 1 + SCHEMA_MAX_FIELDS;
+    return sizeof(intermediate_t) + len + variables * (sizeof(intermediate_variable_t) + 3 * 8) + 8;
+}
+
 result_t intermediate_from_buffer(char *buffer, int len, intermediate_t **out) {
-    result_t res = result_ok();
-    intermediate_t *intermediate = calloc(1, sizeof(intermediate_t));
-    intermediate->id = intermediate_generate_id();
-    intermediate_control_e cc = INTERMEDIATE_NONE;
+    arena_t *arena = arena_new(intermediate_arena_size(len));
+    result_t res = intermediate_from_buffer_arena(buffer, len, arena, out);
+    if (!res.is_ok) {
+        arena_delete(arena);
+        return res;
+    }
 
-    char *head = buffer;
-    while (head < buffer + len && cc != INTERMEDIATE_END) {
-        switch ((intermediate_control_e)*head) {
-            case INTERMEDIATE_HEADER:
-                head++;
-                if (cc != INTERMEDIATE_NONE) {
-                    res = result_error("Intermediate contents are out of order.");
-                    goto cleanup;
-                }
-
-                if ((buffer + len) - head < (long long)sizeof(float)) {
-                    res = result_error("Intermediate wasn't correctly sized.");
-                    goto cleanup;
-                }
-                intermediate->version = *(float *)head;
-                head += sizeof(float);
-
-                if ((buffer + len) - head < (long long)sizeof(uint32_t)) {
-                    res = result_error("Intermediate wasn't correctly sized.");
-                    goto cleanup;
-                }
-                intermediate->id = *(uint32_t *)head;
-                head += sizeof(uint32_t);
+    (*out)->owns_arena = true;
+    return res;
+}
 
-                if ((buffer + len) - head < (long long)sizeof(uint32_t)) {
-                    res = result_error("Intermediate wasn't correctly sized.");
-                    goto cleanup;
-                }
-                intermediate->reply = *(uint32_t *)head;
-                head += sizeof(uint32_t);
+result_t intermediate_from_buffer_arena(char *buffer, int len, arena_t *arena, intermediate_t **out) {
+    result_t res;
+    intermediate_view_t view;
+    if (!(res = intermediate_view_from_buffer(buffer, len, &view)).is_ok)
+        return res;
+
+    intermediate_t *intermediate = arena_alloc(arena, sizeof(intermediate_t));
+    if (!intermediate || !(intermediate->type = arena_strdup(arena, view.type)))
+        return result_error("Intermediate didn't fit its arena.");
+    intermediate->version = view.version;
+    intermediate->id = view.id;
+    intermediate->reply = view.reply;
+    intermediate->arena = arena;
+
+    intermediate_view_var_t v;
+    for (const char *cursor = view.variables; intermediate_view_next(&view, &cursor, &v);) {
+        intermediate_variable_t *var = arena_alloc(arena, sizeof(intermediate_variable_t));
+        if (!var || !(var->value = arena_alloc(arena, v.size)))
+            return result_error("Intermediate didn't fit its arena.");
+        // Names of symbols and schema fields live as long as the server, only those in the frame are copied
+        var->name = (char *)v.name;
+        if (v.name >= view.buffer && v.name < view.buffer + view.len && !(var->name = arena_strdup(arena, v.name)))
+            return result_error("Intermediate didn't fit its arena.");
+        var->type = v.type;
+        var->internal = intermediate_is_internal(v.name);
+        var->symbol = intermediate_symbol_find(v.name);
+        memcpy(var->value, v.value, v.size);
+
+        var->next = intermediate->variables;
+        intermediate->variables = var;
+    }
+
+    *out = intermediate;
+    return res;
+}
+
+int intermediate_frame_length(const char *buffer, uint64_t len) {
+    const char *head = buffer, *end = buffer + (len < MAX_INTERMEDIATE_SIZE ? len : MAX_INTERMEDIATE_SIZE);
+    int size;
+
+    if (head >= end)
+        return 0;
+
+    // Bundles say how long they are up front
+    if ((intermediate_control_e)*head == INTERMEDIATE_BUNDLE) {
+        if (end - head < (long long)(sizeof(char) + sizeof(uint16_t)))
+            goto incomplete;
+        uint16_t bundle_len;
+        memcpy(&bundle_len, head + sizeof(char), sizeof(uint16_t));
+        if (bundle_len < INTERMEDIATE_BUNDLE_HEADER_SIZE || bundle_len > MAX_INTERMEDIATE_SIZE)
+            return -1;
+        return end - head < bundle_len ? 0 : bundle_len;
+    }
 
-                if (strlen(head) > MAX_INTERMEDIATE_STRING_LENGTH || (long long)strlen(head) > buffer + len - head) {
-                    res = result_error("Intermediate wasn't correctly sized.");
-                    goto cleanup;
-                }
-                intermediate->type = _strdup(head);
-                head += strlen(head) + 1;
+    if ((intermediate_control_e)*head != INTERMEDIATE_HEADER)
+        return -1;
+    intermediate_scan_t scan = intermediate_scan_new(buffer, end - buffer);
+    head += INTERMEDIATE_TYPE_OFFSET;
+    if (head >= end)
+        goto incomplete;
+    if ((size = intermediate_scan_string(&scan, head, end)) <= 0)
+        goto invalid;
+    head += size;
 
-                cc = INTERMEDIATE_HEADER;
+    while (head < end) {
+        intermediate_control_e control = *head++;
+        switch (control) {
+            case INTERMEDIATE_END:
+                return head - buffer;
+
+            case INTERMEDIATE_BASELINE:
+                head += sizeof(uint32_t);
+                break;
+
+            case INTERMEDIATE_SCHEMA: {
+                const schema_t *schema = schema_find(buffer + INTERMEDIATE_TYPE_OFFSET);
+                if (!schema)
+                    return -1;
+                head += schema->size;
                 break;
+            }
 
             case INTERMEDIATE_VARIABLE:
-                head++;
-                if (cc != INTERMEDIATE_HEADER && cc != INTERMEDIATE_VARIABLE) {
-                    res = result_error("Intermediate contents are out of order.");
-                    goto cleanup;
-                }
-
-                intermediate_variable_t *var = calloc(1, sizeof(intermediate_variable_t));
-                if (strlen(head) > MAX_INTERMEDIATE_STRING_LENGTH || (long long)strlen(head) > buffer + len - head) {
-                    free(var);
-                    res = result_error("Intermediate wasn't correctly sized.");
-                    goto cleanup;
-                }
-                var->name = _strdup(head);
-                head += strlen(var->name) + 1;
-
-                if ((buffer + len) - head < (long long)sizeof(char)) {
-                    free(var);
-                    res = result_error("Intermediate wasn't correctly sized.");
-                    goto cleanup;
-                }
-                var->type = *head;
-                head += sizeof(char);
-
-                switch (var->type) {
-                    case INTERMEDIATE_STRING:
-                        if (*head == '\0') {
-                            head++;
-                            free(var->name);
-                            free(var);
-                            continue;
-                        }
-                        if (strlen(head) > MAX_INTERMEDIATE_STRING_LENGTH || (long long)strlen(head) > buffer + len - head) {
-                            free(var);
-                            res = result_error("Intermediate wasn't correctly sized.");
-                            goto cleanup;
-                        }
-                        var->value = _strdup(head);
-                        head += strlen(head) + 1;
-                        break;
-
-                    case INTERMEDIATE_S8:
-                    case INTERMEDIATE_U8:
-                        if ((buffer + len) - head < (long long)sizeof(int8_t)) {
-                            free(var);
-                            res = result_error("Intermediate wasn't correctly sized.");
-                            goto cleanup;
-                        }
-                        var->value = calloc(1, sizeof(int8_t));
-                        memcpy(var->value, head, sizeof(int8_t));
-                        head += sizeof(int8_t);
-                        break;
-
-                    case INTERMEDIATE_S16:
-                    case INTERMEDIATE_U16:
-                        if ((buffer + len) - head < (long long)sizeof(int16_t)) {
-                            free(var);
-                            res = result_error("Intermediate wasn't correctly sized.");
-                            goto cleanup;
-                        }
-                        var->value = calloc(1, sizeof(int16_t));
-                        memcpy(var->value, head, sizeof(int16_t));
-                        head += sizeof(int16_t);
-                        break;
-
-                    case INTERMEDIATE_S32:
-                    case INTERMEDIATE_U32:
-                    case INTERMEDIATE_F32:
-                        if ((buffer + len) - head < (long long)sizeof(int32_t)) {
-                            free(var);
-                            res = result_error("Intermediate wasn't correctly sized.");
-                            goto cleanup;
-                        }
-                        var->value = calloc(1, sizeof(int32_t));
-                        memcpy(var->value, head, sizeof(int32_t));
-                        head += sizeof(int32_t);
-                        break;
-
-                    case INTERMEDIATE_S64:
-                    case INTERMEDIATE_U64:
-                    case INTERMEDIATE_F64:
-                        if ((buffer + len) - head < (long long)sizeof(int64_t)) {
-                            free(var);
-                            res = result_error("Intermediate wasn't correctly sized.");
-                            goto cleanup;
-                        }
-                        var->value = calloc(1, sizeof(int64_t));
-                        memcpy(var->value, head, sizeof(int64_t));
-                        head += sizeof(int64_t);
-                        break;
-                }
-
-                var->next = intermediate->variables;
-                intermediate->variables = var;
-                cc = INTERMEDIATE_VARIABLE;
+            case INTERMEDIATE_SYMBOL_VARIABLE: {
+                uint32_t symbol;
+                if (control == INTERMEDIATE_SYMBOL_VARIABLE) {
+                    if (!(size = intermediate_symbol_read(head, end, &symbol)))
+                        goto incomplete;
+                } else if ((size = intermediate_scan_string(&scan, head, end)) <= 0)
+                    goto invalid;
+                head += size;
+
+                if (head >= end)
+                    goto incomplete;
+                intermediate_type_e type = *head++;
+                if ((size = intermediate_scan_value(&scan, type, head, end)) <= 0)
+                    goto invalid;
+                head += size;
                 break;
+            }
+
+            default:
+                return -1;
+        }
+    }
+
+incomplete:
+    // Anything that can't fit in a frame will never complete
+    return len >= MAX_INTERMEDIATE_SIZE ? -1 : 0;
+invalid:
+    return size < 0 || len >= MAX_INTERMEDIATE_SIZE ? -1 : 0;
+}
+
+result_t intermediate_view_from_buffer(const char *buffer, int len, intermediate_view_t *out) {
+    const char *head = buffer, *end = buffer + len;
+    int size;
+
+    if (len < (int)INTERMEDIATE_TYPE_OFFSET)
+        return result_error("Intermediate wasn't correctly sized.");
+    if ((intermediate_control_e)*head != INTERMEDIATE_HEADER)
+        return result_error("Intermediate contents are out of order.");
+
+    *out = (intermediate_view_t) { .buffer = buffer, .len = len };
+    intermediate_scan_t scan = intermediate_scan_new(buffer, len);
+    memcpy(&out->version, head + sizeof(char), sizeof(float));
+    memcpy(&out->id, head + sizeof(char) + sizeof(float), sizeof(uint32_t));
+    memcpy(&out->reply, head + sizeof(char) + sizeof(float) + sizeof(uint32_t), sizeof(uint32_t));
+    head += INTERMEDIATE_TYPE_OFFSET;
 
+    if ((size = intermediate_scan_string(&scan, head, end)) <= 0)
+        return result_error("Intermediate wasn't correctly sized.");
+    out->type = head;
+    head += size;
+    out->variables = head;
+
+    // Frames may end without INTERMEDIATE_END at the end of the buffer
+    while (head < end) {
+        intermediate_control_e control = *head++;
+        switch (control) {
             case INTERMEDIATE_END:
-                cc = INTERMEDIATE_END;
+                head = end;
                 break;
 
-            default: {
-                res = result_error("Intermediate contents are out of order.");
-                goto cleanup;
+            case INTERMEDIATE_VARIABLE:
+            case INTERMEDIATE_SYMBOL_VARIABLE: {
+                const char *name = head;
+                if (control == INTERMEDIATE_SYMBOL_VARIABLE) {
+                    uint32_t symbol;
+                    if (!(size = intermediate_symbol_read(head, end, &symbol)))
+                        return result_error("Intermediate wasn't correctly sized.");
+                    if (!(name = intermediate_symbol_name(symbol)))
+                        return result_error("Intermediate uses undefined symbol %u.", symbol);
+                } else if ((size = intermediate_scan_string(&scan, head, end)) <= 0)
+                    return result_error("Intermediate wasn't correctly sized.");
+                head += size;
+
+                if (head >= end)
+                    return result_error("Intermediate wasn't correctly sized.");
+                intermediate_type_e type = *head++;
+                if (intermediate_type_size(type) < 0)
+                    return result_error("Intermediate variable '%s' has unknown type %d.", name, type);
+                if ((size = intermediate_scan_value(&scan, type, head, end)) <= 0)
+                    return result_error("Intermediate wasn't correctly sized.");
+                head += size;
+                break;
             }
+
+            case INTERMEDIATE_SCHEMA:
+                if (head - 1 != out->variables)
+                    return result_error("Intermediate contents are out of order.");
+                if (!(out->schema = schema_find(out->type)))
+                    return result_error("Intermediate type '%s' has no schema.", out->type);
+                if (end - head < (long long)out->schema->size)
+                    return result_error("Intermediate wasn't correctly sized.");
+                out->variables = head;
+                head += out->schema->size;
+                if (head < end && (intermediate_control_e)*head != INTERMEDIATE_END)
+                    return result_error("Intermediate contents are out of order.");
+                head = end;
+                break;
+
+            case INTERMEDIATE_BASELINE:
+                return result_error("Delta intermediates are only sent by the server.");
+
+            default:
+                return result_error("Intermediate contents are out of order.");
         }
     }
 
-    if (intermediate->version != INTERMEDIATE_VERSION) {
-        res = result_error("This server doesn't support intermediate version %f.", intermediate->version);
-        goto cleanup;
+    if (out->version != INTERMEDIATE_VERSION)
+        return result_error("This server doesn't support intermediate version %f.", out->version);
+    return result_ok();
+}
+
+bool intermediate_view_next(const intermediate_view_t *self, const char **cursor, intermediate_view_var_t *out) {
+    if (self->schema) {
+        const schema_field_t *field = schema_field_at(self->schema, *cursor - self->variables);
+        if (!field)
+            return false;
+        *out = (intermediate_view_var_t) {
+            .name = field->name,
+            .type = field->type,
+            .value = *cursor,
+            .size = intermediate_type_size(field->type),
+        };
+        *cursor += out->size;
+        return true;
     }
 
-    *out = intermediate;
-    return res;
-cleanup:
-    intermediate_delete(intermediate);
-    return res;
+    // The frame was validated up front, so only the layout needs following
+    const char *end = self->buffer + self->len;
+    while (*cursor < end && ((intermediate_control_e)**cursor == INTERMEDIATE_VARIABLE || (intermediate_control_e)**cursor == INTERMEDIATE_SYMBOL_VARIABLE)) {
+        const char *head = *cursor + 1;
+        if ((intermediate_control_e)**cursor == INTERMEDIATE_SYMBOL_VARIABLE) {
+            uint32_t symbol;
+            head += intermediate_symbol_read(head, end, &symbol);
+            out->name = intermediate_symbol_name(symbol);
+        } else {
+            out->name = head;
+            head += strlen(head) + 1;
+        }
+        out->type = *head++;
+        out->size = intermediate_value_length(out->type, head, end);
+        out->value = head;
+        *cursor = head + out->size;
+
+        // Empty strings aren't kept
+        if (out->type == INTERMEDIATE_STRING && out->size == 1)
+            continue;
+        return true;
+    }
+    return false;
+}
+
+bool intermediate_view_find(const intermediate_view_t *self, const char *name, intermediate_view_var_t *out) {
+    if (self->schema) {
+        const schema_field_t *field = schema_field(self->schema, name);
+        if (!field)
+            return false;
+        const char *cursor = self->variables + field->offset;
+        return intermediate_view_next(self, &cursor, out);
+    }
+
+    for (const char *cursor = self->variables; intermediate_view_next(self, &cursor, out);) {
+        if (strcmp(out->name, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+result_t intermediate_bundle_from_buffer(const char *buffer, int len, intermediate_bundle_t *out) {
+    if (len < (int)INTERMEDIATE_BUNDLE_HEADER_SIZE || (intermediate_control_e)*buffer != INTERMEDIATE_BUNDLE)
+        return result_error("Bundle wasn't correctly sized.");
+
+    uint16_t bundle_len;
+    memcpy(&bundle_len, buffer + sizeof(char), sizeof(uint16_t));
+    *out = (intermediate_bundle_t) {
+        .buffer = buffer,
+        .len = len,
+        .count = (uint8_t)buffer[sizeof(char) + sizeof(uint16_t)],
+        .frames = buffer + INTERMEDIATE_BUNDLE_HEADER_SIZE,
+    };
+    if (bundle_len != len)
+        return result_error("Bundle wasn't correctly sized.");
+    if (out->count > INTERMEDIATE_MAX_BUNDLE)
+        return result_error("Bundle carries more than %d frames.", INTERMEDIATE_MAX_BUNDLE);
+
+    // Every frame has to fit, and together they have to fill the bundle exactly
+    const char *head = out->frames, *end = buffer + len;
+    for (uint8_t i = 0; i < out->count; ++i) {
+        uint16_t frame_len;
+        if (end - head < (long long)sizeof(uint16_t))
+            return result_error("Bundle wasn't correctly sized.");
+        memcpy(&frame_len, head, sizeof(uint16_t));
+        head += sizeof(uint16_t);
+        if (!frame_len || end - head < frame_len)
+            return result_error("Bundle wasn't correctly sized.");
+        if ((intermediate_control_e)*head == INTERMEDIATE_BUNDLE)
+            return result_error("Bundles can't be nested.");
+        head += frame_len;
+    }
+    if (head != end)
+        return result_error("Bundle wasn't correctly sized.");
+    return result_ok();
+}
+
+bool intermediate_bundle_next(const intermediate_bundle_t *self, const char **cursor, const char **frame, int *len) {
+    if (*cursor >= self->buffer + self->len)
+        return false;
+
+    uint16_t frame_len;
+    memcpy(&frame_len, *cursor, sizeof(uint16_t));
+    *frame = *cursor + sizeof(uint16_t);
+    *len = frame_len;
+    *cursor = *frame + frame_len;
+    return true;
+}
+
+int intermediate_bundle_write(const char **frames, const int *lens, uint32_t count, char *buffer, int capacity) {
+    int len = INTERMEDIATE_BUNDLE_HEADER_SIZE;
+    for (uint32_t i = 0; i < count; ++i)
+        len += sizeof(uint16_t) + lens[i];
+    if (len > capacity || len > UINT16_MAX || count > INTERMEDIATE_MAX_BUNDLE)
+        return -1;
+
+    uint16_t bundle_len = len;
+    char *head = buffer;
+    *head = (char)INTERMEDIATE_BUNDLE;
+    head += sizeof(char);
+    memcpy(head, &bundle_len, sizeof(uint16_t));
+    head += sizeof(uint16_t);
+    *head = (char)count;
+    head += sizeof(uint8_t);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        uint16_t frame_len = lens[i];
+        memcpy(head, &frame_len, sizeof(uint16_t));
+        head += sizeof(uint16_t);
+        memcpy(head, frames[i], lens[i]);
+        head += lens[i];
+    }
+    return len;
+}
+
+intermediate_view_t intermediate_view_copy(const intermediate_view_t *self) {
+    intermediate_view_t copy = *self;
+    char *buffer = malloc(self->len);
+    memcpy(buffer, self->buffer, self->len);
+    copy.buffer = buffer;
+    copy.type = buffer + (self->type - self->buffer);
+    copy.variables = buffer + (self->variables - self->buffer);
+    return copy;
+}
+
+int intermediate_type_size(intermediate_type_e type) {
+    switch (type) {
+        case INTERMEDIATE_STRING:
+            return 0;
+
+        case INTERMEDIATE_S8:
+        case INTERMEDIATE_U8:
+            return sizeof(int8_t);
+
+        case INTERMEDIATE_S16:
+        case INTERMEDIATE_U16:
+            return sizeof(int16_t);
+
+        case INTERMEDIATE_S32:
+        case INTERMEDIATE_U32:
+        case INTERMEDIATE_F32:
+            return sizeof(int32_t);
+
+        case INTERMEDIATE_S64:
+        case INTERMEDIATE_U64:
+        case INTERMEDIATE_F64:
+            return sizeof(int64_t);
+
+        case INTERMEDIATE_F16:
+            return sizeof(uint16_t);
+
+        case INTERMEDIATE_VARINT:
+        case INTERMEDIATE_ZIGZAG:
+        case INTERMEDIATE_FIXED:
+        case INTERMEDIATE_BYTES:
+        case INTERMEDIATE_ARRAY:
+            return 0;
+    }
+    return -1;
 }
 
 void intermediate_add_var(intermediate_t *self, char *name, intermediate_type_e type, void *data, int size) {
     intermediate_variable_t *var = calloc(1, sizeof(intermediate_variable_t));
     var->name = _strdup(name);
     var->type = type;
+    var->internal = intermediate_is_internal(name);
+    var->symbol = intermediate_symbol_find(name);
 
     var->value = malloc(size);
     memcpy(var->value, data, size);
@@ -307,64 +943,211 @@ void intermediate_add_var(intermediate_t *self, char *name, intermediate_type_e
 }
 
 void intermediate_auto_number_var(intermediate_t *self, char *name, double number) {
-    intermediate_variable_t *var = calloc(1, sizeof(intermediate_variable_t));
+    // Candidates in order of preference, the first of the smallest wins
+    intermediate_type_e candidates[3];
+    int count = 0;
+    bool exact = true;
 
-    var->name = _strdup(name);
+    if (isfinite(number) && number == floor(number) && number >= 0 && number < 18446744073709551616.0) {
+        candidates[count++] = number <= UINT8_MAX ? INTERMEDIATE_U8
+            : number <= UINT16_MAX ? INTERMEDIATE_U16
+            : number <= UINT32_MAX ? INTERMEDIATE_U32
+            : INTERMEDIATE_U64;
+        candidates[count++] = INTERMEDIATE_VARINT;
+    } else if (isfinite(number) && number == floor(number) && number < 0 && number >= -9223372036854775808.0) {
+        candidates[count++] = number >= INT8_MIN ? INTERMEDIATE_S8
+            : number >= INT16_MIN ? INTERMEDIATE_S16
+            : number >= INT32_MIN ? INTERMEDIATE_S32
+            : INTERMEDIATE_S64;
+        candidates[count++] = INTERMEDIATE_ZIGZAG;
+    } else {
+        // Single precision has always been the fallback, even where it rounds
+        candidates[count++] = fabs(number) > FLT_MAX && isfinite(number) ? INTERMEDIATE_F64 : INTERMEDIATE_F32;
+        if (fabs(number) < 4611686018427387904.0) {
+            candidates[count++] = INTERMEDIATE_F16;
+            candidates[count++] = INTERMEDIATE_FIXED;
+        }
+        exact = false;
+    }
 
-    bool is_float = number - floor(number) != 0;
+    char value[INTERMEDIATE_MAX_NUMBER_SIZE], candidate[INTERMEDIATE_MAX_NUMBER_SIZE];
+    intermediate_type_e type = candidates[0];
+    int size = intermediate_number_value(type, number, value);
+    for (int i = 1; i < count; ++i) {
+        int candidate_size = intermediate_number_value(candidates[i], number, candidate);
+        if (candidate_size >= size)
+            continue;
 
-    if (is_float) {
-        if (number > FLT_MAX) {
-            var->type = INTERMEDIATE_F64;
-            var->value = malloc(sizeof(double));
-            *(double *)var->value = number;
-        } else {
-            var->type = INTERMEDIATE_F32;
-            var->value = malloc(sizeof(float));
-            *(float *)var->value = number;
+        // Quantized encodings are only picked when they lose nothing
+        double decoded;
+        if (!exact && (!intermediate_read_number(candidates[i], candidate, &decoded) || decoded != number))
+            continue;
+
+        type = candidates[i];
+        size = candidate_size;
+        memcpy(value, candidate, size);
+    }
+
+    intermediate_add_var(self, name, type, value, size);
+}
+
+/// Largest doubles below 2^63 and 2^64, the limits themselves don't fit a 64 bit integer.
+#define INTERMEDIATE_S64_LIMIT 9223372036854774784.0
+#define INTERMEDIATE_U64_LIMIT 18446744073709549568.0
+
+/// Clamp a number into an integer type's range, converting one outside of it is undefined. NaN becomes 0.
+static double intermediate_clamp(double number, double min, double max) {
+    if (isnan(number))
+        return 0;
+    return number < min ? min : number > max ? max : number;
+}
+
+/// Narrow a number to single precision, finite numbers past its range become infinities.
+static float intermediate_narrow(double number) {
+    if (isfinite(number) && fabs(number) > FLT_MAX)
+        return number > 0 ? INFINITY : -INFINITY;
+    return (float)number;
+}
+
+int intermediate_number_value(intermediate_type_e type, double number, void *out) {
+    switch (type) {
+        case INTERMEDIATE_S8:
+            *(int8_t *)out = intermediate_clamp(number, INT8_MIN, INT8_MAX);
+            break;
+        case INTERMEDIATE_S16:
+            *(int16_t *)out = intermediate_clamp(number, INT16_MIN, INT16_MAX);
+            break;
+        case INTERMEDIATE_S32:
+            *(int32_t *)out = intermediate_clamp(number, INT32_MIN, INT32_MAX);
+            break;
+        case INTERMEDIATE_S64:
+            *(int64_t *)out = intermediate_clamp(number, (double)INT64_MIN, INTERMEDIATE_S64_LIMIT);
+            break;
+
+        case INTERMEDIATE_U8:
+            *(uint8_t *)out = intermediate_clamp(number, 0, UINT8_MAX);
+            break;
+        case INTERMEDIATE_U16:
+            *(uint16_t *)out = intermediate_clamp(number, 0, UINT16_MAX);
+            break;
+        case INTERMEDIATE_U32:
+            *(uint32_t *)out = intermediate_clamp(number, 0, UINT32_MAX);
+            break;
+        case INTERMEDIATE_U64:
+            *(uint64_t *)out = intermediate_clamp(number, 0, INTERMEDIATE_U64_LIMIT);
+            break;
+
+        case INTERMEDIATE_F32:
+            *(float *)out = intermediate_narrow(number);
+            break;
+        case INTERMEDIATE_F64:
+            *(double *)out = number;
+            break;
+
+        case INTERMEDIATE_VARINT:
+            return intermediate_varint_write(out, (uint64_t)intermediate_clamp(number, 0, INTERMEDIATE_U64_LIMIT));
+        case INTERMEDIATE_ZIGZAG:
+            return intermediate_varint_write(out, intermediate_zigzag_encode((int64_t)intermediate_clamp(number, (double)INT64_MIN, INTERMEDIATE_S64_LIMIT)));
+
+        case INTERMEDIATE_F16: {
+            uint16_t half = intermediate_f16_from_float(intermediate_narrow(number));
+            memcpy(out, &half, sizeof(uint16_t));
+            break;
         }
-    } else {
-        if (number > 0) {
-            if (number < UINT8_MAX) {
-                var->type = INTERMEDIATE_U8;
-                var->value = malloc(sizeof(uint8_t));
-                *(uint8_t *)var->value = number;
-            } if (number > UINT8_MAX && number < UINT16_MAX) {
-                var->type = INTERMEDIATE_U16;
-                var->value = malloc(sizeof(uint16_t));
-                *(uint16_t *)var->value = number;
-            } else if (number > UINT16_MAX && number < UINT32_MAX) {
-                var->type = INTERMEDIATE_U32;
-                var->value = malloc(sizeof(uint32_t));
-                *(uint32_t *)var->value = number;
-            } else {
-                var->type = INTERMEDIATE_U64;
-                var->value = malloc(sizeof(uint64_t));
-                *(uint64_t *)var->value = number;
-            }
-        } else {
-            if (number < INT8_MIN) {
-                var->type = INTERMEDIATE_S8;
-                var->value = malloc(sizeof(int8_t));
-                *(int8_t *)var->value = number;
-            } if (number < INT8_MIN && number > INT16_MIN) {
-                var->type = INTERMEDIATE_S16;
-                var->value = malloc(sizeof(int16_t));
-                *(int16_t *)var->value = number;
-            } else if (number < INT16_MIN && number > INT32_MIN) {
-                var->type = INTERMEDIATE_S32;
-                var->value = malloc(sizeof(int32_t));
-                *(int32_t *)var->value = number;
-            } else {
-                var->type = INTERMEDIATE_S64;
-                var->value = malloc(sizeof(int64_t));
-                *(int64_t *)var->value = number;
+
+        case INTERMEDIATE_FIXED: {
+            // As few places as keep the number exact, without the scaled value leaving 62 bits
+            number = intermediate_clamp(number, -4611686018427387904.0, 4611686018427387904.0);
+            uint8_t places = 0;
+            double scale = 1;
+            while (places < INTERMEDIATE_MAX_FIXED_PLACES && round(number * scale) / scale != number
+                && fabs(number * scale * 10) < 4611686018427387904.0) {
+                places++;
+                scale *= 10;
             }
+            *(uint8_t *)out = places;
+            return intermediate_varint_write((char *)out + 1, intermediate_zigzag_encode((int64_t)round(number * scale))) + 1;
         }
+
+        default:
+            return -1;
     }
+    return intermediate_type_size(type);
+}
 
-    var->next = self->variables;
-    self->variables = var;
+bool intermediate_read_number(intermediate_type_e type, const void *value, double *out) {
+    union {
+        int8_t s8;
+        int16_t s16;
+        int32_t s32;
+        int64_t s64;
+        uint8_t u8;
+        uint16_t u16;
+        uint32_t u32;
+        uint64_t u64;
+        float f32;
+        double f64;
+    } number;
+
+    int size = intermediate_type_size(type);
+    if (size > 0)
+        memcpy(&number, value, size);
+
+    switch (type) {
+        case INTERMEDIATE_S8:
+            *out = number.s8;
+            return true;
+        case INTERMEDIATE_S16:
+            *out = number.s16;
+            return true;
+        case INTERMEDIATE_S32:
+            *out = number.s32;
+            return true;
+        case INTERMEDIATE_S64:
+            *out = number.s64;
+            return true;
+
+        case INTERMEDIATE_U8:
+            *out = number.u8;
+            return true;
+        case INTERMEDIATE_U16:
+            *out = number.u16;
+            return true;
+        case INTERMEDIATE_U32:
+            *out = number.u32;
+            return true;
+        case INTERMEDIATE_U64:
+            *out = number.u64;
+            return true;
+
+        case INTERMEDIATE_F32:
+            *out = number.f32;
+            return true;
+        case INTERMEDIATE_F64:
+            *out = number.f64;
+            return true;
+
+        case INTERMEDIATE_VARINT:
+            *out = intermediate_varint_read(value);
+            return true;
+        case INTERMEDIATE_ZIGZAG:
+            *out = intermediate_zigzag_decode(intermediate_varint_read(value));
+            return true;
+        case INTERMEDIATE_F16:
+            *out = intermediate_f16_to_float(number.u16);
+            return true;
+        case INTERMEDIATE_FIXED: {
+            const char *head = value;
+            double scale = 1;
+            for (uint8_t places = *(const uint8_t *)head; places; --places)
+                scale *= 10;
+            *out = intermediate_zigzag_decode(intermediate_varint_read(head + 1)) / scale;
+            return true;
+        }
+
+        default:
+            return false;
+    }
 }
 
 uint32_t intermediate_generate_id(void) {
@@ -373,3 +1156,43 @@ uint32_t intermediate_generate_id(void) {
         return max(((uint32_t)rand() << 16) | (uint32_t)rand(), 1);
     return uuid;
 }
+
+intermediate_symbols_t intermediate_symbols;
+
+int32_t intermediate_symbol_define(const char *name) {
+    intermediate_symbols_t *symbols = &intermediate_symbols;
+    if (symbols->frozen)
+        return -1;
+    if (!symbols->names)
+        symbols->ids = hashtable_string();
+
+    int32_t symbol = intermediate_symbol_find(name);
+    if (symbol >= 0)
+        return symbol;
+    if (symbols->count >= INTERMEDIATE_MAX_SYMBOLS)
+        return -1;
+
+    if (symbols->count == symbols->capacity) {
+        symbols->capacity = symbols->capacity ? symbols->capacity * 2 : 16;
+        symbols->names = realloc(symbols->names, symbols->capacity * sizeof(char *));
+    }
+    symbol = symbols->count++;
+    symbols->names[symbol] = _strdup(name);
+    hashtable_insert(&symbols->ids, (void *)name, &symbol, sizeof(int32_t));
+    return symbol;
+}
+
+int32_t intermediate_symbol_find(const char *name) {
+    if (!intermediate_symbols.count)
+        return -1;
+    int32_t *symbol = hashtable_get(&intermediate_symbols.ids, (void *)name);
+    return symbol ? *symbol : -1;
+}
+
+const char *intermediate_symbol_name(uint32_t symbol) {
+    return symbol < intermediate_symbols.count ? intermediate_symbols.names[symbol] : nullptr;
+}
+
+void intermediate_symbols_freeze(void) {
+    intermediate_symbols.frozen = true;
+}
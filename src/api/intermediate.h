@@ -1,10 +1,35 @@
 #pragma once
 #include "../data/result.h"
+#include "../data/arena.h"
+#include "../data/hashtable.h"
+#include <stdbool.h>
 #include <stdint.h>
 
 #define INTERMEDIATE_VERSION 1.0f
 #define MAX_INTERMEDIATE_SIZE 1024
 #define MAX_INTERMEDIATE_STRING_LENGTH 512
+/// Offset of the event type within a frame, after the control byte, version, id and reply.
+#define INTERMEDIATE_TYPE_OFFSET (sizeof(char) + sizeof(float) + sizeof(uint32_t) * 2)
+
+/// Size of the control byte, length and count that start a bundle.
+#define INTERMEDIATE_BUNDLE_HEADER_SIZE (sizeof(char) + sizeof(uint16_t) + sizeof(uint8_t))
+/// Most frames a bundle may carry.
+#define INTERMEDIATE_MAX_BUNDLE 32
+
+/// Most bytes an INTERMEDIATE_VARINT takes, enough for any 64 bit value.
+#define INTERMEDIATE_MAX_VARINT_SIZE 10
+/// Most decimal places of an INTERMEDIATE_FIXED.
+#define INTERMEDIATE_MAX_FIXED_PLACES 9
+/// Most bytes a value of any numeric type takes.
+#define INTERMEDIATE_MAX_NUMBER_SIZE (INTERMEDIATE_MAX_VARINT_SIZE + 1)
+
+/// Size of the length before the data of an INTERMEDIATE_BYTES.
+#define INTERMEDIATE_BYTES_HEADER_SIZE sizeof(uint16_t)
+/// Size of the element type and count before the elements of an INTERMEDIATE_ARRAY.
+#define INTERMEDIATE_ARRAY_HEADER_SIZE (sizeof(uint8_t) + sizeof(uint16_t))
+
+/// Symbols are numbered below this, so an id takes at most two bytes on the wire.
+#define INTERMEDIATE_MAX_SYMBOLS 0x8000
 
 extern const char *INTERNAL_VARIABLES[];
 
@@ -23,12 +48,31 @@ typedef enum intermediate_type_e {
 
     INTERMEDIATE_F32,
     INTERMEDIATE_F64,
+
+    /// Unsigned LEB128, seven bits a byte with the high bit set on every byte but the last.
+    INTERMEDIATE_VARINT,
+    /// Signed, zigzag mapped so small magnitudes stay small and then written as INTERMEDIATE_VARINT.
+    INTERMEDIATE_ZIGZAG,
+    /// IEEE 754 half precision float.
+    INTERMEDIATE_F16,
+    /// Fixed point, a u8 count of decimal places followed by the value scaled by ten to that as INTERMEDIATE_ZIGZAG.
+    INTERMEDIATE_FIXED,
+
+    /// Raw data, a u16 length followed by that many bytes.
+    INTERMEDIATE_BYTES,
+    /// A u8 element type, a u16 count and the elements packed back to back.
+    /// Elements are any fixed size number, so s8 to f64 or f16.
+    INTERMEDIATE_ARRAY,
 } intermediate_type_e;
 
 typedef struct intermediate_variable_t {
     char *name;
     intermediate_type_e type;
     void *value;
+    // Named after one of INTERNAL_VARIABLES, which are never encoded
+    bool internal;
+    // Symbol of the name, or -1 if it has none
+    int32_t symbol;
 
     struct intermediate_variable_t *next;
 } intermediate_variable_t;
@@ -38,26 +82,155 @@ typedef enum intermediate_control_e {
     INTERMEDIATE_HEADER,
     INTERMEDIATE_VARIABLE,
     INTERMEDIATE_END,
+    /// Followed by the id of the intermediate this one is a delta of.
+    /// Variables that aren't present keep their value from that intermediate.
+    INTERMEDIATE_BASELINE,
+    /// Replaces the header of a compressed frame, followed by the u16 compressed and original lengths.
+    /// Only sent by the server, the data is a zstd frame using the configured dictionary.
+    INTERMEDIATE_COMPRESSED,
+    /// Only on UDP, followed by the u8 lane and u16 sequence of the frame after it.
+    /// The receiver answers with an INTERMEDIATE_ACK, see reliable_t.
+    INTERMEDIATE_RELIABLE,
+    /// Only on UDP, followed by the u8 lane, the u16 sequence acknowledged and a u32 of the 32 sequences before it.
+    INTERMEDIATE_ACK,
+    /// A variable whose name is replaced by its symbol, see intermediate_symbols_t.
+    /// Symbols below 0x80 take one byte, others two with the high bit of the first set.
+    INTERMEDIATE_SYMBOL_VARIABLE,
+    /// Replaces every variable of a frame whose type has a schema, followed by the values in the schema's layout.
+    /// Only INTERMEDIATE_END may come after it, see schema_t.
+    INTERMEDIATE_SCHEMA,
+    /// Replaces the header of a frame carrying others, followed by the u16 length of the whole bundle,
+    /// the u8 count of frames and each frame after its u16 length. Bundles can't be nested.
+    INTERMEDIATE_BUNDLE,
 } intermediate_control_e;
 
+/// Names shared between the server and clients that accepted them, sent as ids instead of text.
+/// Symbols are declared by scripts while they load and can't change afterwards.
+typedef struct intermediate_symbols_t {
+    char **names;
+    uint32_t count, capacity;
+    hashtable_t ids;
+    bool frozen;
+} intermediate_symbols_t;
+
+extern intermediate_symbols_t intermediate_symbols;
+
 typedef struct intermediate_t {
     float version;
     uint32_t id, reply;
     char *type;
     intermediate_variable_t *variables;
+
+    // Decoded intermediates are allocated in an arena and can't have variables added
+    arena_t *arena;
+    bool owns_arena;
 } intermediate_t;
 
+/// A validated frame read in place, without copying anything out of it.
+/// Variables are read one at a time with intermediate_view_next, starting from variables.
+typedef struct intermediate_view_t {
+    const char *buffer;
+    int len;
+    float version;
+    uint32_t id, reply;
+    const char *type;
+    const char *variables;
+    // Layout of a schema frame, whose variables are its packed values, or nullptr
+    const struct schema_t *schema;
+} intermediate_view_t;
+
+/// A variable read in place, the value isn't necessarily aligned.
+typedef struct intermediate_view_var_t {
+    const char *name;
+    intermediate_type_e type;
+    const char *value;
+    int size;
+} intermediate_view_var_t;
+
+/// A validated bundle read in place, its frames are read one at a time with intermediate_bundle_next starting from frames.
+/// Only the bundle's layout is validated, every frame still has to be.
+typedef struct intermediate_bundle_t {
+    const char *buffer;
+    int len;
+    uint8_t count;
+    const char *frames;
+} intermediate_bundle_t;
+
 /// Create a default intermediate.
 intermediate_t *intermediate_new(char *event, uint32_t reply);
 void intermediate_delete(intermediate_t *self);
 
-/// Convert an intermediate into a buffer.
+/// Encode an intermediate into a buffer, returns the length or -1 if it needs more than capacity bytes.
+int intermediate_write(intermediate_t *self, char *buffer, int capacity);
+/// Encode an intermediate into the calling thread's scratch buffer, without allocating once it is big enough.
+/// If symbols is set, names with a symbol are sent as one and intermediates matching their type's schema in its layout.
+/// The result is only valid until the thread encodes another intermediate.
+const char *intermediate_to_scratch(intermediate_t *self, bool symbols, int *len);
+/// Convert an intermediate into a buffer that must be freed.
 char *intermediate_to_buffer(intermediate_t *self, int *len);
-/// Insert an intermediate at the start of the list.
+/// Encode an intermediate into scratch with only the variables that differ from a baseline.
+/// Falls back to a full intermediate if there is no baseline or variables were removed since it.
+/// saved receives how many bytes were left out compared to a full intermediate.
+const char *intermediate_to_delta(intermediate_t *self, intermediate_t *baseline, uint32_t baseline_id, bool symbols, int *len, int *saved);
+/// Deep copy an intermediate, keeping its id.
+intermediate_t *intermediate_copy(intermediate_t *self);
+/// Decode an intermediate into an arena of its own, freed in one go by intermediate_delete.
 result_t intermediate_from_buffer(char *buffer, int len, intermediate_t **out);
+/// Decode an intermediate into a shared arena, which must hold intermediate_arena_size(len) more bytes.
+/// Deleting the intermediate does nothing, its memory is released by resetting the arena.
+result_t intermediate_from_buffer_arena(char *buffer, int len, arena_t *arena, intermediate_t **out);
+/// Arena space needed to decode a frame of len bytes.
+uint64_t intermediate_arena_size(int len);
 
+/// Validate a frame and read its header, the view points into the buffer and is only valid as long as it.
+result_t intermediate_view_from_buffer(const char *buffer, int len, intermediate_view_t *out);
+/// Read the variable at cursor and move cursor past it, cursor starts at the view's variables.
+/// Returns false once there are no more variables.
+bool intermediate_view_next(const intermediate_view_t *self, const char **cursor, intermediate_view_var_t *out);
+/// Find a variable by name, returns false if there is none.
+bool intermediate_view_find(const intermediate_view_t *self, const char *name, intermediate_view_var_t *out);
+/// Copy the frame a view reads from so the view outlives it, the copy's buffer must be freed.
+intermediate_view_t intermediate_view_copy(const intermediate_view_t *self);
+/// Validate the layout of a bundle, the bundle points into the buffer and is only valid as long as it.
+result_t intermediate_bundle_from_buffer(const char *buffer, int len, intermediate_bundle_t *out);
+/// Read the frame at cursor and move cursor past it, cursor starts at the bundle's frames.
+/// Returns false once there are no more frames.
+bool intermediate_bundle_next(const intermediate_bundle_t *self, const char **cursor, const char **frame, int *len);
+/// Write frames into a bundle, returns its length or -1 if they need more than capacity bytes.
+int intermediate_bundle_write(const char **frames, const int *lens, uint32_t count, char *buffer, int capacity);
+
+/// Find the length of the frame at the start of a buffer without decoding it.
+/// Returns the frame length, 0 if the frame is incomplete or -1 if it is malformed.
+int intermediate_frame_length(const char *buffer, uint64_t len);
+
+
+/// Size of a value of the given type on the wire.
+/// Returns 0 for variable length types and -1 for unknown types.
+int intermediate_type_size(intermediate_type_e type);
 
 void intermediate_add_var(intermediate_t *self, char *name, intermediate_type_e type, void *data, int size);
+/// Whether a variable name is reserved for the event table and never sent.
+bool intermediate_is_internal(const char *name);
+/// Find a variable by name, returns nullptr if there is none.
+intermediate_variable_t *intermediate_find_var(intermediate_t *self, const char *name);
+/// Add a number with the type that encodes it in the fewest bytes.
+/// Integers and numbers that half precision or a few decimal places hold exactly are kept exact, others become f32 or f64.
 void intermediate_auto_number_var(intermediate_t *self, char *name, double number);
+/// Convert a number to a value of a numeric type, returns its size or -1 if the type isn't numeric.
+/// out must hold INTERMEDIATE_MAX_NUMBER_SIZE bytes, fixed point values get as few decimal places as keep them exact.
+/// Numbers outside an integer type's range are clamped to it and NaN becomes 0, floats past their range become infinities.
+int intermediate_number_value(intermediate_type_e type, double number, void *out);
+/// Read a value of a numeric type, which may be unaligned, returns false if the type isn't numeric.
+bool intermediate_read_number(intermediate_type_e type, const void *value, double *out);
+
+uint32_t intermediate_generate_id(void);
 
-uint32_t intermediate_generate_id(void);
\ No newline at end of file
+/// Give a name a symbol, returns the symbol or -1 if the table is full or frozen.
+/// Names that already have one keep it.
+int32_t intermediate_symbol_define(const char *name);
+/// Find the symbol of a name, returns -1 if it has none.
+int32_t intermediate_symbol_find(const char *name);
+/// Find the name of a symbol, returns nullptr if it isn't defined.
+const char *intermediate_symbol_name(uint32_t symbol);
+/// Stop symbols from being defined, so they can be read without locking.
+void intermediate_symbols_freeze(void);
\ No newline at end of file
@@ -0,0 +1,229 @@
+#include "arrays.h"
+#include "../schema.h"
+#include <stdint.h>
+#include <string.h>
+
+scripting_function_t api_arrays_functions[] = {
+    { "new", api_arrays_new },
+    { "from_string", api_arrays_from_string },
+    { "bytes", api_arrays_bytes },
+};
+
+__attribute__((constructor)) void api_arrays_init(void) {
+    scripting_modules[SCRIPTING_MODULES_ARRAYS] = (scripting_module_t) {
+        .name = "arrays",
+        .function_count = sizeof(api_arrays_functions) / sizeof(scripting_function_t),
+        .functions = api_arrays_functions,
+    };
+}
+
+static uint16_t api_arrays_count(const char *value) {
+    uint16_t count;
+    memcpy(&count, value + sizeof(uint8_t), sizeof(uint16_t));
+    return count;
+}
+
+/// Check that an argument names a type arrays can hold, any fixed size number.
+static intermediate_type_e api_arrays_check_type(lua_State *L, int index) {
+    const char *name = luaL_checkstring(L, index);
+    int type = schema_parse_type(name);
+    if (type < 0 || intermediate_type_size(type) <= 0)
+        luaL_error(L, "Arrays can't hold elements of type '%s'.", name);
+    return type;
+}
+
+/// Check that the argument at index is an array and that key is one of its indices.
+static char *api_arrays_check_element(lua_State *L, int index, lua_Integer key) {
+    char *value = luaL_checkudata(L, index, API_ARRAY_METATABLE);
+    if (key < 1 || key > api_arrays_count(value))
+        return nullptr;
+    return value + INTERMEDIATE_ARRAY_HEADER_SIZE + (key - 1) * intermediate_type_size((uint8_t)*value);
+}
+
+static int api_arrays_index(lua_State *L) {
+    if (!lua_isinteger(L, 2)) {
+        lua_pushvalue(L, 2);
+        lua_gettable(L, lua_upvalueindex(1));
+        return 1;
+    }
+
+    double number;
+    const char *element = api_arrays_check_element(L, 1, lua_tointeger(L, 2));
+    if (!element || !intermediate_read_number((uint8_t)*(const char *)lua_touserdata(L, 1), element, &number))
+        return 0;
+    lua_pushnumber(L, number);
+    return 1;
+}
+
+static int api_arrays_newindex(lua_State *L) {
+    char *element = api_arrays_check_element(L, 1, luaL_checkinteger(L, 2));
+    double number = luaL_checknumber(L, 3);
+    if (!element)
+        return luaL_error(L, "Array index %I is out of range.", lua_tointeger(L, 2));
+
+    char value[INTERMEDIATE_MAX_NUMBER_SIZE];
+    int size = intermediate_number_value((uint8_t)*(const char *)lua_touserdata(L, 1), number, value);
+    memcpy(element, value, size);
+    return 0;
+}
+
+static int api_arrays_len(lua_State *L) {
+    lua_pushinteger(L, api_arrays_count(luaL_checkudata(L, 1, API_ARRAY_METATABLE)));
+    return 1;
+}
+
+static int api_arrays_to_string(lua_State *L) {
+    const char *value = luaL_checkudata(L, 1, API_ARRAY_METATABLE);
+    lua_pushlstring(L, value + INTERMEDIATE_ARRAY_HEADER_SIZE, api_arrays_count(value) * intermediate_type_size((uint8_t)*value));
+    return 1;
+}
+
+static int api_arrays_to_table(lua_State *L) {
+    const char *value = luaL_checkudata(L, 1, API_ARRAY_METATABLE);
+    intermediate_type_e type = (uint8_t)*value;
+    uint16_t count = api_arrays_count(value);
+    int size = intermediate_type_size(type);
+
+    lua_createtable(L, count, 0);
+    for (uint16_t i = 0; i < count; ++i) {
+        double number;
+        intermediate_read_number(type, value + INTERMEDIATE_ARRAY_HEADER_SIZE + i * size, &number);
+        lua_pushnumber(L, number);
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+}
+
+/// Push an array of count zeroed elements and return its value.
+static char *api_arrays_create(lua_State *L, intermediate_type_e type, lua_Integer count) {
+    if (count < 0 || count > UINT16_MAX)
+        luaL_error(L, "Arrays hold between 0 and %d elements.", UINT16_MAX);
+
+    int size = INTERMEDIATE_ARRAY_HEADER_SIZE + count * intermediate_type_size(type);
+    char *value = lua_newuserdatauv(L, size, 0);
+    memset(value, 0, size);
+    *value = (char)type;
+    uint16_t elements = count;
+    memcpy(value + sizeof(uint8_t), &elements, sizeof(uint16_t));
+
+    // Created the first time an array is
+    if (luaL_newmetatable(L, API_ARRAY_METATABLE)) {
+        lua_newtable(L);
+        lua_pushcfunction(L, api_arrays_to_string);
+        lua_setfield(L, -2, "to_string");
+        lua_pushcfunction(L, api_arrays_to_table);
+        lua_setfield(L, -2, "to_table");
+        lua_pushcclosure(L, api_arrays_index, 1);
+        lua_setfield(L, -2, "__index");
+
+        lua_pushcfunction(L, api_arrays_newindex);
+        lua_setfield(L, -2, "__newindex");
+        lua_pushcfunction(L, api_arrays_len);
+        lua_setfield(L, -2, "__len");
+    }
+    lua_setmetatable(L, -2);
+
+    return value;
+}
+
+void api_arrays_push(lua_State *L, const char *value) {
+    intermediate_type_e type = (uint8_t)*value;
+    uint16_t count = api_arrays_count(value);
+    char *array = api_arrays_create(L, type, count);
+    memcpy(array + INTERMEDIATE_ARRAY_HEADER_SIZE, value + INTERMEDIATE_ARRAY_HEADER_SIZE, count * intermediate_type_size(type));
+}
+
+const char *api_arrays_test(lua_State *L, int index, int *size) {
+    const char *value = luaL_testudata(L, index, API_ARRAY_METATABLE);
+    if (value)
+        *size = lua_rawlen(L, index);
+    return value;
+}
+
+int api_arrays_new(lua_State *L) {
+    intermediate_type_e type = api_arrays_check_type(L, 1);
+    if (!lua_istable(L, 2)) {
+        api_arrays_create(L, type, luaL_checkinteger(L, 2));
+        return 1;
+    }
+
+    lua_Integer count = lua_rawlen(L, 2);
+    char *element = api_arrays_create(L, type, count) + INTERMEDIATE_ARRAY_HEADER_SIZE;
+    int size = intermediate_type_size(type);
+    for (lua_Integer i = 1; i <= count; ++i, element += size) {
+        int is_number;
+        lua_rawgeti(L, 2, i);
+        double number = lua_tonumberx(L, -1, &is_number);
+        if (!is_number)
+            return luaL_error(L, "Element %I of the array isn't a number.", i);
+        lua_pop(L, 1);
+
+        char value[INTERMEDIATE_MAX_NUMBER_SIZE];
+        intermediate_number_value(type, number, value);
+        memcpy(element, value, size);
+    }
+    return 1;
+}
+
+int api_arrays_from_string(lua_State *L) {
+    intermediate_type_e type = api_arrays_check_type(L, 1);
+    size_t len;
+    const char *data = luaL_checklstring(L, 2, &len);
+    int size = intermediate_type_size(type);
+    if (len % size)
+        return luaL_error(L, "A string of %d bytes isn't a whole number of '%s' elements.", (int)len, lua_tostring(L, 1));
+
+    char *value = api_arrays_create(L, type, len / size);
+    memcpy(value + INTERMEDIATE_ARRAY_HEADER_SIZE, data, len);
+    return 1;
+}
+
+static uint16_t api_arrays_bytes_length(const char *value) {
+    uint16_t len;
+    memcpy(&len, value, sizeof(uint16_t));
+    return len;
+}
+
+static int api_arrays_bytes_len(lua_State *L) {
+    lua_pushinteger(L, api_arrays_bytes_length(luaL_checkudata(L, 1, API_BYTES_METATABLE)));
+    return 1;
+}
+
+static int api_arrays_bytes_to_string(lua_State *L) {
+    const char *value = luaL_checkudata(L, 1, API_BYTES_METATABLE);
+    lua_pushlstring(L, value + INTERMEDIATE_BYTES_HEADER_SIZE, api_arrays_bytes_length(value));
+    return 1;
+}
+
+const char *api_arrays_test_bytes(lua_State *L, int index, int *size) {
+    const char *value = luaL_testudata(L, index, API_BYTES_METATABLE);
+    if (value)
+        *size = lua_rawlen(L, index);
+    return value;
+}
+
+int api_arrays_bytes(lua_State *L) {
+    size_t len;
+    const char *data = luaL_checklstring(L, 1, &len);
+    if (len > UINT16_MAX)
+        return luaL_error(L, "Bytes hold at most %d bytes.", UINT16_MAX);
+
+    char *value = lua_newuserdatauv(L, INTERMEDIATE_BYTES_HEADER_SIZE + len, 0);
+    uint16_t size = len;
+    memcpy(value, &size, sizeof(uint16_t));
+    memcpy(value + INTERMEDIATE_BYTES_HEADER_SIZE, data, len);
+
+    // Created the first time bytes are
+    if (luaL_newmetatable(L, API_BYTES_METATABLE)) {
+        lua_newtable(L);
+        lua_pushcfunction(L, api_arrays_bytes_to_string);
+        lua_setfield(L, -2, "to_string");
+        lua_setfield(L, -2, "__index");
+
+        lua_pushcfunction(L, api_arrays_bytes_len);
+        lua_setfield(L, -2, "__len");
+    }
+    lua_setmetatable(L, -2);
+
+    return 1;
+}
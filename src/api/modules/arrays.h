@@ -0,0 +1,19 @@
+#pragma once
+#include "modules.h"
+#include "../intermediate.h"
+
+/// Metatable of array userdata, which hold an INTERMEDIATE_ARRAY value exactly as it is sent.
+#define API_ARRAY_METATABLE "net.array"
+/// Metatable of bytes userdata, which hold an INTERMEDIATE_BYTES value exactly as it is sent.
+#define API_BYTES_METATABLE "net.bytes"
+
+/// Push a copy of a validated INTERMEDIATE_ARRAY value, which may be unaligned, as an array.
+void api_arrays_push(lua_State *L, const char *value);
+/// Read the INTERMEDIATE_ARRAY value of the array at index, returns nullptr if it isn't an array.
+const char *api_arrays_test(lua_State *L, int index, int *size);
+/// Read the INTERMEDIATE_BYTES value of the bytes at index, returns nullptr if they aren't bytes.
+const char *api_arrays_test_bytes(lua_State *L, int index, int *size);
+
+int api_arrays_new(lua_State *L);
+int api_arrays_from_string(lua_State *L);
+int api_arrays_bytes(lua_State *L);
@@ -0,0 +1,99 @@
+#include "grid.h"
+#include "packets.h"
+#include "../../net/server.h"
+#include "../../net/client.h"
+#include "../../net/grid.h"
+#include <float.h>
+#include <math.h>
+
+scripting_function_t api_grid_functions[] = {
+    { "move", api_grid_move },
+    { "remove", api_grid_remove },
+
+    { "broadcast_tcp", api_grid_broadcast_tcp },
+    { "broadcast_udp", api_grid_broadcast_udp },
+};
+
+__attribute__((constructor)) void api_grid_init(void) {
+    scripting_modules[SCRIPTING_MODULES_GRID] = (scripting_module_t) {
+        .name = "grid",
+        .function_count = sizeof(api_grid_functions) / sizeof(scripting_function_t),
+        .functions = api_grid_functions,
+    };
+}
+
+/// Check that an argument is a number that fits a float without becoming infinite.
+static float api_grid_check_number(lua_State *L, int arg) {
+    lua_Number number = luaL_checknumber(L, arg);
+    if (!isfinite(number) || fabs(number) > FLT_MAX)
+        luaL_argerror(L, arg, "finite number expected");
+    return number;
+}
+
+int api_grid_move(lua_State *L) {
+    float x = api_grid_check_number(L, 2);
+    float y = api_grid_check_number(L, 3);
+    client_t *c = api_check_client(L, 1);
+    if (!c)
+        return 0;
+
+    grid_move(&server.grid, c, x, y);
+    client_release(c);
+    return 0;
+}
+
+int api_grid_remove(lua_State *L) {
+    client_t *c = api_check_client(L, 1);
+    if (!c)
+        return 0;
+
+    grid_remove(&server.grid, c);
+    client_release(c);
+    return 0;
+}
+
+/// Encode the packet at index 4 and find every client within range of the position at 1 and 2.
+/// Returns the packet, the clients must be released with client_snapshot_release.
+static packet_t *api_grid_prepare(lua_State *L, client_t ***clients, uint32_t *count) {
+    float x = api_grid_check_number(L, 1);
+    float y = api_grid_check_number(L, 2);
+    const char *type = luaL_checkstring(L, 3);
+    luaL_checktype(L, 4, LUA_TTABLE);
+    float radius = lua_isnoneornil(L, 5) ? server.grid.radius : api_grid_check_number(L, 5);
+
+    lua_pushvalue(L, 4);
+    intermediate_t *intermediate = table_to_intermediate(L, (char *)type, 0);
+    lua_pop(L, 1);
+
+    packet_t *packet = packet_from_intermediate(intermediate);
+    intermediate_delete(intermediate);
+
+    *clients = grid_query(&server.grid, x, y, radius, count);
+    return packet;
+}
+
+int api_grid_broadcast_tcp(lua_State *L) {
+    uint32_t count = 0;
+    client_t **clients;
+    packet_t *packet = api_grid_prepare(L, &clients, &count);
+
+    for (client_t **c = clients; c < clients + count; ++c)
+        client_send_packet(*c, packet_retain(packet));
+    client_snapshot_release(clients, count);
+
+    packet_release(packet);
+    return 0;
+}
+
+int api_grid_broadcast_udp(lua_State *L) {
+    uint32_t count = 0;
+    client_t **clients;
+    packet_t *packet = api_grid_prepare(L, &clients, &count);
+
+    for (client_t **c = clients; c < clients + count; ++c)
+        client_send_udp(*c, packet_retain(packet));
+    client_snapshot_release(clients, count);
+
+    packet_release(packet);
+    return 0;
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include "modules.h"
+
+int api_grid_move(lua_State *L);
+int api_grid_remove(lua_State *L);
+
+int api_grid_broadcast_tcp(lua_State *L);
+int api_grid_broadcast_udp(lua_State *L);
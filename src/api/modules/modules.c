@@ -1,2 +1,9 @@
 #include "modules.h"
-scripting_module_t scripting_modules[SCRIPTING_MODULES_COUNT];
\ No newline at end of file
+#include "../../net/client.h"
+scripting_module_t scripting_modules[SCRIPTING_MODULES_COUNT];
+
+client_t *api_check_client(lua_State *L, int index) {
+    if (lua_isinteger(L, index))
+        return client_get((client_handle_t)lua_tointeger(L, index));
+    return client_find(luaL_checkstring(L, index));
+}
@@ -22,7 +22,20 @@ typedef enum scripting_modules_e {
     SCRIPTING_MODULES_PLAYERS,
     SCRIPTING_MODULES_TABLES,
     SCRIPTING_MODULES_CONSOLE,
+    SCRIPTING_MODULES_STATS,
+    SCRIPTING_MODULES_ROOMS,
+    SCRIPTING_MODULES_GRID,
+    SCRIPTING_MODULES_SYMBOLS,
+    SCRIPTING_MODULES_SCHEMA,
+    SCRIPTING_MODULES_ARRAYS,
+    SCRIPTING_MODULES_SHARDS,
     SCRIPTING_MODULES_COUNT,
 } scripting_modules_e;
 
-extern scripting_module_t scripting_modules[SCRIPTING_MODULES_COUNT];
\ No newline at end of file
+extern scripting_module_t scripting_modules[SCRIPTING_MODULES_COUNT];
+
+typedef struct client_t client_t;
+
+/// Check that a function argument is a client uuid or handle and look it up.
+/// Returns a retained client which must be released, or nullptr if it isn't connected.
+client_t *api_check_client(lua_State *L, int index);
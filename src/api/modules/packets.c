@@ -2,6 +2,8 @@
 #include "../../net/server.h"
 #include "../../net/client.h"
 #include "../../io/console.h"
+#include "../schema.h"
+#include "arrays.h"
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +13,14 @@ scripting_function_t api_packets_functions[] = {
     { "broadcast_tcp", api_packets_broadcast_tcp },
 
     { "send_udp", api_packets_send_udp },
+    { "broadcast_udp", api_packets_broadcast_udp },
+
+    { "send_reliable", api_packets_send_reliable },
+
+    { "send_delta_tcp", api_packets_send_delta_tcp },
+    { "send_delta_udp", api_packets_send_delta_udp },
+    { "broadcast_delta_tcp", api_packets_broadcast_delta_tcp },
+    { "broadcast_delta_udp", api_packets_broadcast_delta_udp },
 
     { "reply", api_packets_reply },
 };
@@ -25,6 +35,7 @@ __attribute__((constructor)) void api_packets_init(void) {
 
 intermediate_t *table_to_intermediate(lua_State *L, char *event, uint32_t reply) {
     intermediate_t *intermediate = intermediate_new(event, reply);
+    const schema_t *schema = schema_find(event);
     lua_pushnil(L);
 
     while (lua_next(L, -2)) {
@@ -34,8 +45,21 @@ intermediate_t *table_to_intermediate(lua_State *L, char *event, uint32_t reply)
             continue;
         }
 
-        if (lua_isnumber(L, -1)) {
+        const char *array;
+        int size;
+
+        // Schema fields take their declared type instead of the smallest that fits
+        const schema_field_t *field = schema && lua_type(L, -2) == LUA_TSTRING ? schema_field(schema, lua_tostring(L, -2)) : nullptr;
+        if (field && (lua_isnumber(L, -1) || lua_isboolean(L, -1))) {
+            double number = lua_isboolean(L, -1) ? lua_toboolean(L, -1) : lua_tonumber(L, -1);
+            char value[INTERMEDIATE_MAX_NUMBER_SIZE];
+            intermediate_add_var(intermediate, field->name, field->type, &value, intermediate_number_value(field->type, number, &value));
+        } else if (lua_isnumber(L, -1)) {
             intermediate_auto_number_var(intermediate, (char *)lua_tostring(L, -2), lua_tonumber(L, -1));
+        } else if ((array = api_arrays_test(L, -1, &size))) {
+            intermediate_add_var(intermediate, (char *)lua_tostring(L, -2), INTERMEDIATE_ARRAY, (void *)array, size);
+        } else if ((array = api_arrays_test_bytes(L, -1, &size))) {
+            intermediate_add_var(intermediate, (char *)lua_tostring(L, -2), INTERMEDIATE_BYTES, (void *)array, size);
         } else if (lua_isstring(L, -1)) {
             const char *str = lua_tostring(L, -1);
             intermediate_add_var(intermediate, (char *)lua_tostring(L, -2), INTERMEDIATE_STRING, (char *)str, strlen(str) + 1);
@@ -50,13 +74,21 @@ intermediate_t *table_to_intermediate(lua_State *L, char *event, uint32_t reply)
         lua_pop(L, 1);
     }
 
+    // Fields left out are sent as 0, so the intermediate still fits its schema
+    for (uint32_t i = 0; schema && i < schema->field_count; ++i) {
+        if (!intermediate_find_var(intermediate, schema->fields[i].name)) {
+            uint64_t zero = 0;
+            intermediate_add_var(intermediate, schema->fields[i].name, schema->fields[i].type, &zero, intermediate_type_size(schema->fields[i].type));
+        }
+    }
+
     intermediate->id = intermediate_generate_id();
 
     return intermediate;
 }
 
 int api_packets_send_tcp(lua_State *L) {
-    const char *uuid = luaL_checkstring(L, 1);
+    client_t *c = api_check_client(L, 1);
     const char *type = luaL_checkstring(L, 2);
     luaL_checktype(L, 3, LUA_TTABLE);
 
@@ -64,20 +96,15 @@ int api_packets_send_tcp(lua_State *L) {
     intermediate_t * intermediate = table_to_intermediate(L, (char *)type, 0);
     lua_pop(L, 1);
 
-    int len = 0;
-    char *buffer = intermediate_to_buffer(intermediate, &len);
-    intermediate_delete(intermediate);
-
-    void *ptr = hashtable_get(&server.clients, (void *)uuid);
-    client_t *c;
-    if (!(ptr = hashtable_get(&server.clients, (void *)uuid)) || !(c = *(client_t **)ptr))
+    if (!c) {
+        intermediate_delete(intermediate);
         return 0;
+    }
 
-    mutex_lock(c->mutex);
-    send(c->socket, buffer, len, 0);
-    mutex_release(c->mutex);
+    client_send_packet(c, packet_from_intermediate(intermediate));
+    intermediate_delete(intermediate);
+    client_release(c);
 
-    free(buffer);
     return 0;
 }
 
@@ -89,27 +116,22 @@ int api_packets_broadcast_tcp(lua_State *L) {
     intermediate_t * intermediate = table_to_intermediate(L, (char *)type, 0);
     lua_pop(L, 1);
 
-    int len = 0;
-    char *buffer = intermediate_to_buffer(intermediate, &len);
+    // Encode once, every client queues a reference to the same packet
+    packet_t *packet = packet_from_intermediate(intermediate);
     intermediate_delete(intermediate);
 
     uint32_t count = 0;
-    pair_t **pairs = hashtable_pairs(&server.clients, &count);
-    mutex_lock(server.clients.mutex);
-    for (pair_t **pl = pairs; pl < pairs + count; ++pl) {
-        client_t *client = *(client_t **)(*pl)->value;
-        mutex_lock(client->mutex);
-        send(client->socket, buffer, len, 0);
-        mutex_release(client->mutex);
-    }
-    mutex_release(server.clients.mutex);
+    client_t **clients = client_snapshot(&count);
+    for (client_t **c = clients; c < clients + count; ++c)
+        client_send_packet(*c, packet_retain(packet));
+    client_snapshot_release(clients, count);
 
-    free(buffer);
+    packet_release(packet);
     return 0;
 }
 
 int api_packets_send_udp(lua_State *L) {
-    const char *uuid = luaL_checkstring(L, 1);
+    client_t *c = api_check_client(L, 1);
     const char *type = luaL_checkstring(L, 2);
     luaL_checktype(L, 3, LUA_TTABLE);
 
@@ -117,18 +139,14 @@ int api_packets_send_udp(lua_State *L) {
     intermediate_t * intermediate = table_to_intermediate(L, (char *)type, 0);
     lua_pop(L, 1);
 
-    int len = 0;
-    char *buffer = intermediate_to_buffer(intermediate, &len);
-    intermediate_delete(intermediate);
-
-    void *ptr = hashtable_get(&server.clients, (void *)uuid);
-    client_t *c;
-    if (!(ptr = hashtable_get(&server.clients, (void *)uuid)) || !(c = *(client_t **)ptr))
+    if (!c) {
+        intermediate_delete(intermediate);
         return 0;
+    }
 
-    mutex_lock(c->mutex);
-    sendto(c->socket, buffer, len, 0, (struct sockaddr *)&c->address, sizeof(struct sockaddr *));
-    mutex_release(c->mutex);
+    client_send_udp(c, packet_from_intermediate(intermediate));
+    intermediate_delete(intermediate);
+    client_release(c);
 
     return 0;
 }
@@ -141,23 +159,92 @@ int api_packets_broadcast_udp(lua_State *L) {
     intermediate_t * intermediate = table_to_intermediate(L, (char *)type, 0);
     lua_pop(L, 1);
 
-    int len = 0;
-    char *buffer = intermediate_to_buffer(intermediate, &len);
+    packet_t *packet = packet_from_intermediate(intermediate);
     intermediate_delete(intermediate);
 
     uint32_t count = 0;
-    pair_t **pairs = hashtable_pairs(&server.clients, &count);
-    for (pair_t **pl = pairs; pl < pairs + count; ++pl) {
-        client_t *client = *(client_t **)(*pl)->value;
-        mutex_lock(client->mutex);
-        sendto(server.udp_socket, buffer, len, 0, (struct sockaddr *)&client->address, sizeof(struct sockaddr));
-        mutex_release(client->mutex);
+    client_t **clients = client_snapshot(&count);
+    for (client_t **c = clients; c < clients + count; ++c)
+        client_send_udp(*c, packet_retain(packet));
+    client_snapshot_release(clients, count);
+
+    packet_release(packet);
+    return 0;
+}
+
+int api_packets_send_reliable(lua_State *L) {
+    client_t *c = api_check_client(L, 1);
+    const char *type = luaL_checkstring(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);
+    bool ordered = lua_isnoneornil(L, 4) || lua_toboolean(L, 4);
+
+    lua_pushvalue(L, 3);
+    intermediate_t *intermediate = table_to_intermediate(L, (char *)type, 0);
+    lua_pop(L, 1);
+
+    if (c) {
+        client_send_reliable(c, packet_from_intermediate(intermediate), ordered);
+        client_release(c);
     }
+    intermediate_delete(intermediate);
 
-    free(buffer);
     return 0;
 }
 
+/// Send a state to one client through delta encoding.
+static int api_packets_send_delta(lua_State *L, bool udp) {
+    client_t *c = api_check_client(L, 1);
+    const char *type = luaL_checkstring(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);
+
+    lua_pushvalue(L, 3);
+    intermediate_t *intermediate = table_to_intermediate(L, (char *)type, 0);
+    lua_pop(L, 1);
+
+    if (c) {
+        client_send_delta(c, intermediate, udp);
+        client_release(c);
+    }
+    intermediate_delete(intermediate);
+
+    return 0;
+}
+
+/// Send a state to every client through delta encoding, each against its own baseline.
+static int api_packets_broadcast_delta(lua_State *L, bool udp) {
+    const char *type = luaL_checkstring(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    lua_pushvalue(L, 2);
+    intermediate_t *intermediate = table_to_intermediate(L, (char *)type, 0);
+    lua_pop(L, 1);
+
+    uint32_t count = 0;
+    client_t **clients = client_snapshot(&count);
+    for (client_t **c = clients; c < clients + count; ++c)
+        client_send_delta(*c, intermediate, udp);
+    client_snapshot_release(clients, count);
+
+    intermediate_delete(intermediate);
+    return 0;
+}
+
+int api_packets_send_delta_tcp(lua_State *L) {
+    return api_packets_send_delta(L, false);
+}
+
+int api_packets_send_delta_udp(lua_State *L) {
+    return api_packets_send_delta(L, true);
+}
+
+int api_packets_broadcast_delta_tcp(lua_State *L) {
+    return api_packets_broadcast_delta(L, false);
+}
+
+int api_packets_broadcast_delta_udp(lua_State *L) {
+    return api_packets_broadcast_delta(L, true);
+}
+
 int api_packets_reply(lua_State *L) {
     luaL_checktype(L, 1, LUA_TTABLE);
     luaL_checktype(L, 2, LUA_TTABLE);
@@ -183,10 +270,14 @@ int api_packets_reply(lua_State *L) {
     lua_getfield(L, 1, "client");
     if (!lua_istable(L, -1))
         return 0;
-    lua_getfield(L, -1, "uuid");
-    if (!lua_isstring(L, -1))
-        return 0;
-    const char *uuid = lua_tostring(L, -1);
+    lua_getfield(L, -1, "handle");
+    if (!lua_isinteger(L, -1)) {
+        lua_pop(L, 1);
+        lua_getfield(L, -1, "uuid");
+        if (!lua_isstring(L, -1))
+            return 0;
+    }
+    client_t *c = api_check_client(L, -1);
     lua_pop(L, 2);
 
     lua_pushvalue(L, 2);
@@ -194,19 +285,14 @@ int api_packets_reply(lua_State *L) {
     intermediate_t * intermediate = table_to_intermediate(L, (char *)type, reply);
     lua_pop(L, 1);
 
-    int len = 0;
-    char *buffer = intermediate_to_buffer(intermediate, &len);
-    intermediate_delete(intermediate);
-
-    void *ptr = hashtable_get(&server.clients, (void *)uuid);
-    client_t *c;
-    if (!(ptr = hashtable_get(&server.clients, (void *)uuid)) || !(c = *(client_t **)ptr))
+    if (!c) {
+        intermediate_delete(intermediate);
         return 0;
+    }
 
-    mutex_lock(c->mutex);
-    send(c->socket, buffer, len, 0);
-    mutex_release(c->mutex);
+    client_send_packet(c, packet_from_intermediate(intermediate));
+    intermediate_delete(intermediate);
+    client_release(c);
 
-    free(buffer);
     return 0;
 }
\ No newline at end of file
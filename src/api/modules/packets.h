@@ -1,5 +1,9 @@
 #pragma once
 #include "modules.h"
+#include "../intermediate.h"
+
+/// Convert the table on top of the stack to an intermediate.
+intermediate_t *table_to_intermediate(lua_State *L, char *event, uint32_t reply);
 
 int api_packets_send_tcp(lua_State *L);
 int api_packets_broadcast_tcp(lua_State *L);
@@ -7,4 +11,11 @@ int api_packets_broadcast_tcp(lua_State *L);
 int api_packets_send_udp(lua_State *L);
 int api_packets_broadcast_udp(lua_State *L);
 
+int api_packets_send_reliable(lua_State *L);
+
+int api_packets_send_delta_tcp(lua_State *L);
+int api_packets_send_delta_udp(lua_State *L);
+int api_packets_broadcast_delta_tcp(lua_State *L);
+int api_packets_broadcast_delta_udp(lua_State *L);
+
 int api_packets_reply(lua_State *L);
\ No newline at end of file
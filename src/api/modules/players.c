@@ -16,15 +16,14 @@ __attribute__((constructor)) void api_players_init(void) {
 }
 
 int api_players_kick(lua_State *L) {
-    const char *uuid = luaL_checkstring(L, 1);
     const char *reason = luaL_checkstring(L, 2);
 
-    void *ptr = hashtable_get(&server.clients, (void *)uuid);
-    client_t *c;
-    if (!(ptr = hashtable_get(&server.clients, (void *)uuid)) || !(c = *(client_t **)ptr))
+    client_t *c = api_check_client(L, 1);
+    if (!c)
         return 0;
 
     client_kick(c, reason);
+    client_release(c);
 
     return 0;
 }
\ No newline at end of file
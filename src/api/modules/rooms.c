@@ -0,0 +1,91 @@
+#include "rooms.h"
+#include "packets.h"
+#include "../../net/server.h"
+#include "../../net/client.h"
+#include "../../net/rooms.h"
+
+scripting_function_t api_rooms_functions[] = {
+    { "join", api_rooms_join },
+    { "leave", api_rooms_leave },
+
+    { "broadcast_tcp", api_rooms_broadcast_tcp },
+    { "broadcast_udp", api_rooms_broadcast_udp },
+};
+
+__attribute__((constructor)) void api_rooms_init(void) {
+    scripting_modules[SCRIPTING_MODULES_ROOMS] = (scripting_module_t) {
+        .name = "rooms",
+        .function_count = sizeof(api_rooms_functions) / sizeof(scripting_function_t),
+        .functions = api_rooms_functions,
+    };
+}
+
+int api_rooms_join(lua_State *L) {
+    const char *room = luaL_checkstring(L, 2);
+    client_t *c = api_check_client(L, 1);
+    if (!c) {
+        lua_pushboolean(L, false);
+        return 1;
+    }
+
+    lua_pushboolean(L, rooms_join(&server.rooms, room, c->handle));
+    client_release(c);
+    return 1;
+}
+
+int api_rooms_leave(lua_State *L) {
+    const char *room = luaL_checkstring(L, 2);
+    client_t *c = api_check_client(L, 1);
+    if (!c) {
+        lua_pushboolean(L, false);
+        return 1;
+    }
+
+    lua_pushboolean(L, rooms_leave(&server.rooms, room, c->handle));
+    client_release(c);
+    return 1;
+}
+
+int api_rooms_broadcast_tcp(lua_State *L) {
+    const char *room = luaL_checkstring(L, 1);
+    const char *type = luaL_checkstring(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);
+
+    lua_pushvalue(L, 3);
+    intermediate_t *intermediate = table_to_intermediate(L, (char *)type, 0);
+    lua_pop(L, 1);
+
+    packet_t *packet = packet_from_intermediate(intermediate);
+    intermediate_delete(intermediate);
+
+    uint32_t count = 0;
+    client_t **clients = rooms_snapshot(&server.rooms, room, &count);
+    for (client_t **c = clients; c < clients + count; ++c)
+        client_send_packet(*c, packet_retain(packet));
+    client_snapshot_release(clients, count);
+
+    packet_release(packet);
+    return 0;
+}
+
+int api_rooms_broadcast_udp(lua_State *L) {
+    const char *room = luaL_checkstring(L, 1);
+    const char *type = luaL_checkstring(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);
+
+    lua_pushvalue(L, 3);
+    intermediate_t *intermediate = table_to_intermediate(L, (char *)type, 0);
+    lua_pop(L, 1);
+
+    packet_t *packet = packet_from_intermediate(intermediate);
+    intermediate_delete(intermediate);
+
+    uint32_t count = 0;
+    client_t **clients = rooms_snapshot(&server.rooms, room, &count);
+    for (client_t **c = clients; c < clients + count; ++c)
+        client_send_udp(*c, packet_retain(packet));
+    client_snapshot_release(clients, count);
+
+    packet_release(packet);
+    return 0;
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include "modules.h"
+
+int api_rooms_join(lua_State *L);
+int api_rooms_leave(lua_State *L);
+
+int api_rooms_broadcast_tcp(lua_State *L);
+int api_rooms_broadcast_udp(lua_State *L);
@@ -0,0 +1,48 @@
+#include "schema.h"
+#include "../schema.h"
+
+scripting_function_t api_schema_functions[] = {
+    { "define", api_schema_define },
+};
+
+__attribute__((constructor)) void api_schema_init(void) {
+    scripting_modules[SCRIPTING_MODULES_SCHEMA] = (scripting_module_t) {
+        .name = "schema",
+        .function_count = sizeof(api_schema_functions) / sizeof(scripting_function_t),
+        .functions = api_schema_functions,
+    };
+}
+
+int api_schema_define(lua_State *L) {
+    const char *type = luaL_checkstring(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    const char *names[SCHEMA_MAX_FIELDS];
+    intermediate_type_e types[SCHEMA_MAX_FIELDS];
+    uint32_t count = 0;
+
+    lua_pushnil(L);
+    while (lua_next(L, 2)) {
+        if (lua_type(L, -2) != LUA_TSTRING || lua_type(L, -1) != LUA_TSTRING)
+            return luaL_error(L, "Schema '%s' must map field names to type names.", type);
+        if (count == SCHEMA_MAX_FIELDS)
+            return luaL_error(L, "Schema '%s' has more than %d fields.", type, SCHEMA_MAX_FIELDS);
+
+        int field_type = schema_parse_type(lua_tostring(L, -1));
+        if (field_type < 0)
+            return luaL_error(L, "Field '%s' of schema '%s' has unknown type '%s'.", lua_tostring(L, -2), type, lua_tostring(L, -1));
+
+        // Keys stay referenced by the table, so their strings outlive the loop
+        names[count] = lua_tostring(L, -2);
+        types[count++] = field_type;
+        lua_pop(L, 1);
+    }
+
+    result_t res = schema_define(type, names, types, count);
+    if (!res.is_ok) {
+        lua_pushstring(L, res.description);
+        result_discard(res);
+        return lua_error(L);
+    }
+    return 0;
+}
@@ -0,0 +1,4 @@
+#pragma once
+#include "modules.h"
+
+int api_schema_define(lua_State *L);
@@ -0,0 +1,79 @@
+#include "shards.h"
+#include "packets.h"
+#include "../scripting_api.h"
+#include "../../net/client.h"
+
+scripting_function_t api_shards_functions[] = {
+    { "count", api_shards_count },
+    { "current", api_shards_current },
+    { "of", api_shards_of },
+
+    { "send", api_shards_send },
+    { "broadcast", api_shards_broadcast },
+};
+
+__attribute__((constructor)) void api_shards_init(void) {
+    scripting_modules[SCRIPTING_MODULES_SHARDS] = (scripting_module_t) {
+        .name = "shards",
+        .function_count = sizeof(api_shards_functions) / sizeof(scripting_function_t),
+        .functions = api_shards_functions,
+    };
+}
+
+int api_shards_count(lua_State *L) {
+    lua_pushinteger(L, scripting_shards.count);
+    return 1;
+}
+
+int api_shards_current(lua_State *L) {
+    lua_pushinteger(L, scripting_shard_of(L)->shard);
+    return 1;
+}
+
+int api_shards_of(lua_State *L) {
+    client_t *c = api_check_client(L, 1);
+    if (!c) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    lua_pushinteger(L, c->scripts->shard);
+    client_release(c);
+    return 1;
+}
+
+/// Encode the message table at index 2 for the message type at index 1.
+static intermediate_t *api_shards_check_message(lua_State *L) {
+    const char *type = luaL_checkstring(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    if (!scripting_shards.ready)
+        luaL_error(L, "Messages can't be sent while scripts load.");
+
+    lua_pushvalue(L, 2);
+    intermediate_t *intermediate = table_to_intermediate(L, (char *)type, 0);
+    lua_pop(L, 1);
+    return intermediate;
+}
+
+int api_shards_send(lua_State *L) {
+    lua_Integer shard = luaL_checkinteger(L, 1);
+    if (shard < 0 || shard >= scripting_shards.count)
+        return luaL_error(L, "Shard %I doesn't exist.", shard);
+    lua_remove(L, 1);
+
+    intermediate_t *intermediate = api_shards_check_message(L);
+    scripting_api_send(scripting_shards.list[shard], intermediate, scripting_shard_of(L)->shard);
+    return 0;
+}
+
+int api_shards_broadcast(lua_State *L) {
+    intermediate_t *intermediate = api_shards_check_message(L);
+    uint32_t from = scripting_shard_of(L)->shard;
+
+    for (uint32_t i = 0; i < scripting_shards.count; ++i) {
+        if (i != from)
+            scripting_api_send(scripting_shards.list[i], intermediate_copy(intermediate), from);
+    }
+    intermediate_delete(intermediate);
+    return 0;
+}
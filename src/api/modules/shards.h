@@ -0,0 +1,8 @@
+#pragma once
+#include "modules.h"
+
+int api_shards_count(lua_State *L);
+int api_shards_current(lua_State *L);
+int api_shards_of(lua_State *L);
+int api_shards_send(lua_State *L);
+int api_shards_broadcast(lua_State *L);
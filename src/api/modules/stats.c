@@ -0,0 +1,89 @@
+#include "stats.h"
+#include "../../net/server.h"
+#include <stdlib.h>
+
+scripting_function_t api_stats_functions[] = {
+    { "get", api_stats_get },
+};
+
+__attribute__((constructor)) void api_stats_init(void) {
+    scripting_modules[SCRIPTING_MODULES_STATS] = (scripting_module_t) {
+        .name = "stats",
+        .function_count = sizeof(api_stats_functions) / sizeof(scripting_function_t),
+        .functions = api_stats_functions,
+    };
+}
+
+/// Push a table of per-key counters.
+void api_stats_push_counters(lua_State *L, hashtable_t *table) {
+    lua_newtable(L);
+
+    mutex_lock(table->mutex);
+    uint32_t count = 0;
+    pair_t **pairs = hashtable_pairs(table, &count);
+    for (pair_t **pl = pairs; pl < pairs + count; ++pl) {
+        lua_pushnumber(L, *(uint64_t *)(*pl)->value);
+        lua_setfield(L, -2, (*pl)->key);
+    }
+    free(pairs);
+    mutex_release(table->mutex);
+}
+
+int api_stats_get(lua_State *L) {
+    lua_newtable(L);
+
+    lua_pushnumber(L, server.stats.rate_limited);
+    lua_setfield(L, -2, "rate_limited");
+    api_stats_push_counters(L, &server.stats.rate_limited_events);
+    lua_setfield(L, -2, "rate_limited_events");
+
+    lua_pushnumber(L, server.stats.send_dropped);
+    lua_setfield(L, -2, "send_dropped");
+    lua_pushnumber(L, server.stats.send_conflated);
+    lua_setfield(L, -2, "send_conflated");
+    lua_pushnumber(L, server.stats.slow_disconnects);
+    lua_setfield(L, -2, "slow_disconnects");
+
+    lua_pushnumber(L, server.stats.udp_dropped);
+    lua_setfield(L, -2, "udp_dropped");
+
+    lua_pushnumber(L, server.stats.bundles);
+    lua_setfield(L, -2, "bundles");
+    lua_pushnumber(L, server.stats.bundled);
+    lua_setfield(L, -2, "bundled");
+
+    lua_pushnumber(L, server.stats.reliable_sent);
+    lua_setfield(L, -2, "reliable_sent");
+    lua_pushnumber(L, server.stats.reliable_retransmitted);
+    lua_setfield(L, -2, "reliable_retransmitted");
+
+    lua_pushnumber(L, server.stats.delta_packets);
+    lua_setfield(L, -2, "delta_packets");
+    lua_pushnumber(L, server.stats.delta_saved);
+    lua_setfield(L, -2, "delta_saved");
+
+    // Ratio and cost per byte are derived here so scripts don't need the counter frequency
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    lua_pushnumber(L, server.stats.compressed);
+    lua_setfield(L, -2, "compressed");
+    lua_pushnumber(L, server.stats.compress_in);
+    lua_setfield(L, -2, "compress_in");
+    lua_pushnumber(L, server.stats.compress_out);
+    lua_setfield(L, -2, "compress_out");
+    lua_pushnumber(L, server.stats.compress_in ? (double)server.stats.compress_out / server.stats.compress_in : 1);
+    lua_setfield(L, -2, "compression_ratio");
+    lua_pushnumber(L, server.stats.compress_in ? (double)server.stats.compress_time * 1e9 / frequency.QuadPart / server.stats.compress_in : 0);
+    lua_setfield(L, -2, "compression_ns_per_byte");
+
+    lua_pushnumber(L, server.stats.ticks);
+    lua_setfield(L, -2, "ticks");
+    lua_pushnumber(L, server.stats.tick_overruns);
+    lua_setfield(L, -2, "tick_overruns");
+    lua_pushnumber(L, server.stats.tick_time);
+    lua_setfield(L, -2, "tick_time");
+    lua_pushnumber(L, server.stats.tick_overrun);
+    lua_setfield(L, -2, "tick_overrun");
+
+    return 1;
+}
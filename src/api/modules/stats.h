@@ -0,0 +1,4 @@
+#pragma once
+#include "modules.h"
+
+int api_stats_get(lua_State *L);
@@ -0,0 +1,28 @@
+#include "symbols.h"
+#include "../intermediate.h"
+
+scripting_function_t api_symbols_functions[] = {
+    { "define", api_symbols_define },
+};
+
+__attribute__((constructor)) void api_symbols_init(void) {
+    scripting_modules[SCRIPTING_MODULES_SYMBOLS] = (scripting_module_t) {
+        .name = "symbols",
+        .function_count = sizeof(api_symbols_functions) / sizeof(scripting_function_t),
+        .functions = api_symbols_functions,
+    };
+}
+
+int api_symbols_define(lua_State *L) {
+    int count = lua_gettop(L);
+    for (int i = 1; i <= count; ++i)
+        luaL_checkstring(L, i);
+
+    for (int i = 1; i <= count; ++i) {
+        int32_t symbol = intermediate_symbol_define(lua_tostring(L, i));
+        if (symbol < 0)
+            return luaL_error(L, intermediate_symbols.frozen ? "Symbols can only be defined while scripts load." : "Too many symbols.");
+        lua_pushinteger(L, symbol);
+    }
+    return count;
+}
@@ -0,0 +1,4 @@
+#pragma once
+#include "modules.h"
+
+int api_symbols_define(lua_State *L);
@@ -0,0 +1,159 @@
+#include "schema.h"
+#include "../util/win32.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *SCHEMA_TYPE_NAMES[] = {
+    [INTERMEDIATE_STRING] = "string",
+    [INTERMEDIATE_S8] = "s8",
+    [INTERMEDIATE_S16] = "s16",
+    [INTERMEDIATE_S32] = "s32",
+    [INTERMEDIATE_S64] = "s64",
+    [INTERMEDIATE_U8] = "u8",
+    [INTERMEDIATE_U16] = "u16",
+    [INTERMEDIATE_U32] = "u32",
+    [INTERMEDIATE_U64] = "u64",
+    [INTERMEDIATE_F32] = "f32",
+    [INTERMEDIATE_F64] = "f64",
+    [INTERMEDIATE_VARINT] = "varint",
+    [INTERMEDIATE_ZIGZAG] = "zigzag",
+    [INTERMEDIATE_F16] = "f16",
+    [INTERMEDIATE_FIXED] = "fixed",
+};
+
+schemas_t schemas;
+
+static int schema_compare_fields(const void *a, const void *b) {
+    return strcmp(((const schema_field_t *)a)->name, ((const schema_field_t *)b)->name);
+}
+
+/// Whether a name is an internal variable, which are never sent, or the one schemas are sent with.
+static bool schema_reserved(const char *name) {
+    return strcmp(name, SCHEMA_TYPE_VARIABLE) == 0 || intermediate_is_internal(name);
+}
+
+/// Whether two laid out schemas have the same fields in the same order.
+static bool schema_equal(const schema_t *a, const schema_t *b) {
+    if (a->field_count != b->field_count)
+        return false;
+    for (uint32_t i = 0; i < a->field_count; ++i)
+        if (a->fields[i].type != b->fields[i].type || strcmp(a->fields[i].name, b->fields[i].name) != 0)
+            return false;
+    return true;
+}
+
+/// Free a schema that was never added, fields past the failing one have no name yet.
+static void schema_free(schema_t *self) {
+    for (uint32_t i = 0; i < self->field_count; ++i)
+        free(self->fields[i].name);
+    free(self->fields);
+    free(self->type);
+}
+
+result_t schema_define(const char *type, const char **names, const intermediate_type_e *types, uint32_t count) {
+    if (schemas.frozen)
+        return result_error("Schemas can only be defined while scripts load.");
+    if (!count || count > SCHEMA_MAX_FIELDS)
+        return result_error("Schema '%s' must have between 1 and %d fields.", type, SCHEMA_MAX_FIELDS);
+    if (!schemas.list)
+        schemas.types = hashtable_string();
+    schema_t schema = {
+        .type = _strdup(type),
+        .fields = calloc(count, sizeof(schema_field_t)),
+        .field_count = count,
+    };
+    for (uint32_t i = 0; i < count; ++i) {
+        result_t res = result_ok();
+        if (intermediate_type_size(types[i]) <= 0)
+            res = result_error("Field '%s' of schema '%s' must have a fixed size numeric type.", names[i], type);
+        else if (schema_reserved(names[i]))
+            res = result_error("Field '%s' of schema '%s' has a reserved name.", names[i], type);
+        if (!res.is_ok) {
+            schema_free(&schema);
+            return res;
+        }
+        schema.fields[i] = (schema_field_t) { .name = _strdup(names[i]), .type = types[i] };
+    }
+
+    // Lua tables have no order, so fields are laid out by name
+    qsort(schema.fields, count, sizeof(schema_field_t), schema_compare_fields);
+    for (uint32_t i = 0; i < count; ++i) {
+        schema.fields[i].offset = schema.size;
+        schema.size += intermediate_type_size(schema.fields[i].type);
+    }
+
+    // Every scripting shard loads the same scripts, so the same layout is declared once per shard
+    const schema_t *existing = schema_find(type);
+    if (existing) {
+        bool equal = schema_equal(existing, &schema);
+        schema_free(&schema);
+        return equal ? result_ok() : result_error("Schema '%s' is already defined.", type);
+    }
+
+    // Clients learn the schema from a single frame
+    intermediate_t *description = schema_describe(&schema);
+    int len;
+    intermediate_to_scratch(description, false, &len);
+    intermediate_delete(description);
+    if (len > MAX_INTERMEDIATE_SIZE) {
+        schema_free(&schema);
+        return result_error("Schema '%s' is too large to send to clients.", type);
+    }
+
+    if (schemas.count == schemas.capacity) {
+        schemas.capacity = schemas.capacity ? schemas.capacity * 2 : 16;
+        schemas.list = realloc(schemas.list, schemas.capacity * sizeof(schema_t *));
+    }
+    schema_t *entry = malloc(sizeof(schema_t));
+    *entry = schema;
+    schemas.list[schemas.count++] = entry;
+    hashtable_insert(&schemas.types, (void *)type, &entry, sizeof(schema_t *));
+    return result_ok();
+}
+
+const schema_t *schema_find(const char *type) {
+    if (!schemas.count)
+        return nullptr;
+    schema_t **schema = hashtable_get(&schemas.types, (void *)type);
+    return schema ? *schema : nullptr;
+}
+
+const schema_field_t *schema_field(const schema_t *self, const char *name) {
+    schema_field_t key = { .name = (char *)name };
+    return bsearch(&key, self->fields, self->field_count, sizeof(schema_field_t), schema_compare_fields);
+}
+
+const schema_field_t *schema_field_at(const schema_t *self, uint32_t offset) {
+    uint32_t low = 0, high = self->field_count;
+    while (low < high) {
+        uint32_t middle = (low + high) / 2;
+        if (self->fields[middle].offset < offset)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low < self->field_count && self->fields[low].offset == offset ? &self->fields[low] : nullptr;
+}
+
+intermediate_t *schema_describe(const schema_t *self) {
+    intermediate_t *intermediate = intermediate_new(SCHEMA_EVENT, 0);
+    intermediate_add_var(intermediate, SCHEMA_TYPE_VARIABLE, INTERMEDIATE_STRING, self->type, strlen(self->type) + 1);
+    for (uint32_t i = 0; i < self->field_count; ++i) {
+        uint8_t type = self->fields[i].type;
+        intermediate_add_var(intermediate, self->fields[i].name, INTERMEDIATE_U8, &type, sizeof(uint8_t));
+    }
+    return intermediate;
+}
+
+void schemas_freeze(void) {
+    schemas.frozen = true;
+}
+
+int schema_parse_type(const char *name) {
+    for (int i = 0; i < (int)(sizeof(SCHEMA_TYPE_NAMES) / sizeof(const char *)); ++i) {
+        if (strcmp(SCHEMA_TYPE_NAMES[i], name) == 0)
+            return i;
+    }
+    return -1;
+}
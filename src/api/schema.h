@@ -0,0 +1,57 @@
+#pragma once
+#include "intermediate.h"
+#include "../data/hashtable.h"
+#include "../data/result.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Most fields a schema can have.
+#define SCHEMA_MAX_FIELDS 64
+/// Event type describing one schema, sent to clients after the symbols with each field's type as a u8 variable.
+#define SCHEMA_EVENT "schema"
+/// String variable of a SCHEMA_EVENT holding the event type it is for, fields can't be named after it.
+#define SCHEMA_TYPE_VARIABLE "schema"
+
+typedef struct schema_field_t {
+    char *name;
+    intermediate_type_e type;
+    // Position of the value after the INTERMEDIATE_SCHEMA control byte
+    uint32_t offset;
+} schema_field_t;
+
+/// Fixed layout of an event type's variables.
+/// Fields are ordered by name and packed back to back, so frames carry only their values.
+typedef struct schema_t {
+    char *type;
+    schema_field_t *fields;
+    uint32_t field_count;
+    // Size of every value together
+    uint32_t size;
+} schema_t;
+
+/// Every schema, declared by scripts while they load and unchanged afterwards.
+typedef struct schemas_t {
+    schema_t **list;
+    uint32_t count, capacity;
+    hashtable_t types;
+    bool frozen;
+} schemas_t;
+
+extern schemas_t schemas;
+
+/// Declare the layout of an event type, fields may only have fixed size numeric types and can't be internal variables.
+/// Schemas can only be defined before schemas_freeze, defining one again is only allowed with the same layout.
+result_t schema_define(const char *type, const char **names, const intermediate_type_e *types, uint32_t count);
+/// Find the schema of an event type, returns nullptr if it has none.
+const schema_t *schema_find(const char *type);
+/// Find a field by name, returns nullptr if the schema has none.
+const schema_field_t *schema_field(const schema_t *self, const char *name);
+/// Find the field whose value starts at an offset, returns nullptr if none does.
+const schema_field_t *schema_field_at(const schema_t *self, uint32_t offset);
+/// Create the SCHEMA_EVENT intermediate describing a schema to clients.
+intermediate_t *schema_describe(const schema_t *self);
+/// Stop schemas from being defined, so they can be read without locking.
+void schemas_freeze(void);
+
+/// Parse a type name such as "u16" or "f32", returns -1 if it isn't one.
+int schema_parse_type(const char *name);
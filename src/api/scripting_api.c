@@ -1,9 +1,12 @@
 #include "scripting_api.h"
 #include "modules/modules.h"
+#include "modules/arrays.h"
 #include "../io/console.h"
 #include "../net/socket.h"
 #include "../io/fs.h"
 #include "intermediate.h"
+#include "schema.h"
+#include "../data/crypto.h"
 #include <lauxlib.h>
 #include <lua.h>
 #include <lualib.h>
@@ -13,50 +16,260 @@
 #include <synchapi.h>
 #include <winsock2.h>
 
-result_t scripting_api_new(scripting_api_t *out) {
-    console_header("Initializing Scripting API");
-    out->lua_state = luaL_newstate();
-    luaL_openlibs(out->lua_state);
-    luaL_dostring(out->lua_state, "package.path = package.path .. ';.it/libraries/?.lua");
+/// What a queued message asks of a shard.
+typedef enum scripting_message_e {
+    SCRIPTING_MESSAGE_EVENT,
+    SCRIPTING_MESSAGE_DELETE_CLIENT,
+    SCRIPTING_MESSAGE_SHARD,
+} scripting_message_e;
+
+struct scripting_message_t {
+    scripting_message_e kind;
+    // Client of an event or deletion
+    char *uuid;
+    // Event or shard message, owned by the message
+    intermediate_t *intermediate;
+    // Shard a shard message was sent from
+    uint32_t from;
+    scripting_message_t *next;
+};
+
+scripting_shards_t scripting_shards;
+
+/// Shard the thread is running a script on, anything asked of a shard meanwhile is queued.
+static thread_local scripting_api_t *scripting_running;
+/// Shards the thread queued messages for while running, tried once it stops.
+static thread_local uint64_t scripting_woken;
+
+#define SCRIPTING_REFS_DEFAULT_SIZE 16
+
+/// Find the slot of a key, returns nullptr if there is none.
+/// Empty slots have no key and ref 0, removed ones no key and LUA_NOREF.
+static scripting_ref_t *scripting_refs_find(scripting_refs_t *self, const char *key, uint32_t hash) {
+    if (!self->capacity)
+        return nullptr;
+
+    for (uint32_t i = hash & (self->capacity - 1);; i = (i + 1) & (self->capacity - 1)) {
+        scripting_ref_t *slot = &self->slots[i];
+        if (!slot->key && slot->ref != LUA_NOREF)
+            return nullptr;
+        if (slot->key && slot->hash == hash && strcmp(slot->key, key) == 0)
+            return slot;
+    }
+}
 
-    scripting_api_init_globals(out);
-    console_log("Initialized globals.");
+/// Place a reference in the first free slot for its hash, the key isn't copied.
+static void scripting_refs_place(scripting_refs_t *self, char *key, uint32_t hash, int ref) {
+    for (uint32_t i = hash & (self->capacity - 1);; i = (i + 1) & (self->capacity - 1)) {
+        scripting_ref_t *slot = &self->slots[i];
+        if (!slot->key) {
+            if (slot->ref != LUA_NOREF)
+                self->used++;
+            *slot = (scripting_ref_t) { .key = key, .hash = hash, .ref = ref };
+            self->count++;
+            return;
+        }
+    }
+}
 
-    if (!fs_exists("config.lua"))
-        fs_save("config.lua", DEFAULT_CONFIG, strlen(DEFAULT_CONFIG));
-    luaL_dofile(out->lua_state, "config.lua");
-    console_log("Loaded config.");
+/// Add a reference for a key that has none.
+static void scripting_refs_insert(scripting_refs_t *self, const char *key, uint32_t hash, int ref) {
+    // Keep the slots at most three quarters full, counting removed ones
+    if ((self->used + 1) * 4 > self->capacity * 3) {
+        scripting_refs_t old = *self;
+        uint32_t capacity = SCRIPTING_REFS_DEFAULT_SIZE;
+        while ((self->count + 1) * 2 > capacity)
+            capacity *= 2;
+
+        *self = (scripting_refs_t) { .slots = calloc(capacity, sizeof(scripting_ref_t)), .capacity = capacity };
+        for (uint32_t i = 0; i < old.capacity; ++i) {
+            if (old.slots[i].key)
+                scripting_refs_place(self, old.slots[i].key, old.slots[i].hash, old.slots[i].ref);
+        }
+        free(old.slots);
+    }
 
-    if (!fs_direxists("scripts")) {
-        result_t res;
-        if (!(res = fs_mkdir("scripts")).is_ok) {
-            console_error("Failed to create scripts folder. Are permissions configured correctly?");
-            result_discard(res);
-            exit(-1);
+    scripting_refs_place(self, _strdup(key), hash, ref);
+}
+
+static void scripting_refs_remove(lua_State *L, scripting_refs_t *self, const char *key) {
+    scripting_ref_t *slot = scripting_refs_find(self, key, jhash_str(key));
+    if (!slot)
+        return;
+
+    luaL_unref(L, LUA_REGISTRYINDEX, slot->ref);
+    free(slot->key);
+    *slot = (scripting_ref_t) { .ref = LUA_NOREF };
+    self->count--;
+}
+
+/// Drop every reference, keeping the slots.
+static void scripting_refs_clear(lua_State *L, scripting_refs_t *self) {
+    for (uint32_t i = 0; i < self->capacity; ++i) {
+        if (self->slots[i].key) {
+            luaL_unref(L, LUA_REGISTRYINDEX, self->slots[i].ref);
+            free(self->slots[i].key);
         }
     }
+    if (self->slots)
+        memset(self->slots, 0, self->capacity * sizeof(scripting_ref_t));
+    self->used = self->count = 0;
+}
 
-    fs_recurse("scripts", (void (*)(const char *, void *))scripting_api_load_file, out);
+static void scripting_refs_delete(lua_State *L, scripting_refs_t *self) {
+    scripting_refs_clear(L, self);
+    free(self->slots);
+    *self = (scripting_refs_t) { 0 };
+}
+
+/// Forget every cached handler and miss, net.events has changed.
+static void scripting_api_events_changed(scripting_api_t *self) {
+    scripting_refs_clear(self->lua_state, &self->handlers);
+    scripting_refs_clear(self->lua_state, &self->misses);
+}
+
+/// __newindex of net.events, which stays empty so assigning a handler always lands here.
+static int scripting_api_events_newindex(lua_State *L) {
+    scripting_api_t *self = lua_touserdata(L, lua_upvalueindex(1));
+    lua_settop(L, 3);
+    lua_rawset(L, lua_upvalueindex(2));
+    scripting_api_events_changed(self);
+    return 0;
+}
+
+/// __pairs of net.events, iterating the handlers it reads from.
+static int scripting_api_events_pairs(lua_State *L) {
+    lua_getglobal(L, "next");
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_pushnil(L);
+    return 3;
+}
+
+/// Make the table at index net.events, moving its handlers and metatable to a new table it reads from.
+static void scripting_api_events_wrap(scripting_api_t *self, int index) {
+    lua_State *L = self->lua_state;
+    index = lua_absindex(L, index);
+
+    lua_newtable(L);
+    if (lua_getmetatable(L, index))
+        lua_setmetatable(L, -2);
+    lua_pushnil(L);
+    while (lua_next(L, index)) {
+        lua_pushvalue(L, -2);
+        lua_insert(L, -2);
+        lua_rawset(L, -4);
+        // Clearing the field being visited is allowed while iterating
+        lua_pushvalue(L, -1);
+        lua_pushnil(L);
+        lua_rawset(L, index);
+    }
+
+    luaL_unref(L, LUA_REGISTRYINDEX, self->events);
+    lua_pushvalue(L, -1);
+    self->events = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    lua_createtable(L, 0, 3);
+    lua_pushvalue(L, -2);
+    lua_setfield(L, -2, "__index");
+    lua_pushlightuserdata(L, self);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, scripting_api_events_newindex, 2);
+    lua_setfield(L, -2, "__newindex");
+    lua_pushvalue(L, -2);
+    lua_pushcclosure(L, scripting_api_events_pairs, 1);
+    lua_setfield(L, -2, "__pairs");
+    lua_setmetatable(L, index);
+    lua_pop(L, 1);
+
+    scripting_api_events_changed(self);
+}
+
+/// __newindex of net, which never holds events itself so replacing net.events always lands here.
+static int scripting_api_net_newindex(lua_State *L) {
+    scripting_api_t *self = lua_touserdata(L, lua_upvalueindex(1));
+    lua_settop(L, 3);
+    if (lua_type(L, 2) != LUA_TSTRING || strcmp(lua_tostring(L, 2), "events") != 0) {
+        lua_rawset(L, 1);
+        return 0;
+    }
+
+    // net.events = net.events changes nothing
+    lua_getfield(L, lua_upvalueindex(2), "events");
+    if (lua_rawequal(L, 3, -1))
+        return 0;
+
+    if (lua_istable(L, 3))
+        scripting_api_events_wrap(self, 3);
+    else {
+        luaL_unref(L, LUA_REGISTRYINDEX, self->events);
+        self->events = LUA_NOREF;
+        scripting_api_events_changed(self);
+    }
+    lua_pushvalue(L, 3);
+    lua_setfield(L, lua_upvalueindex(2), "events");
+    return 0;
+}
+
+result_t scripting_api_new(scripting_api_t *out, uint32_t shard) {
+    if (!shard)
+        console_header("Initializing Scripting API");
+    else
+        console_header("Initializing Scripting Shard %u", shard);
+    out->lua_state = luaL_newstate();
+    out->mutex = mutex_new();
+    out->inbox_mutex = mutex_new();
+    out->shard = shard;
+    scripting_shards.list[shard] = out;
+    luaL_openlibs(out->lua_state);
+    luaL_dostring(out->lua_state, "package.path = package.path .. ';.it/libraries/?.lua");
+
+    scripting_api_init_globals(out);
+    console_log("Initialized globals.");
 
+    // Modules are registered first so scripts can use them while they load
     lua_getglobal(out->lua_state, "net");
     for (scripting_module_t *module = scripting_modules; module < scripting_modules + SCRIPTING_MODULES_COUNT; ++module) {
         if (!module->name || !module->functions)
             continue;
-        console_header("Registering Scripting Module '%s'", module->name);
+        if (!shard)
+            console_header("Registering Scripting Module '%s'", module->name);
         lua_newtable(out->lua_state);
         lua_setfield(out->lua_state, -2, module->name);
         lua_getfield(out->lua_state, -1, module->name);
 
         for (scripting_function_t *func = module->functions; func < module->functions + module->function_count; ++func) {
-            console_log("Registering function '%s'", func->name);
+            if (!shard)
+                console_log("Registering function '%s'", func->name);
             lua_pushcfunction(out->lua_state, func->function);
             lua_setfield(out->lua_state, -2, func->name);
         }
 
         lua_pop(out->lua_state, 1);
     }
+    lua_pop(out->lua_state, 1);
 
-    out->mutex = mutex_new();
+    if (!fs_exists("config.lua"))
+        fs_save("config.lua", DEFAULT_CONFIG, strlen(DEFAULT_CONFIG));
+    luaL_dofile(out->lua_state, "config.lua");
+    console_log("Loaded config.");
+
+    // Scripts may ask for the amount of shards while they load, so it is known before any are
+    if (!shard) {
+        float shards;
+        result_discard(scripting_api_config_number(out, "script_shards", &shards, 1));
+        scripting_shards.count = shards < 1 ? 1 : shards > SCRIPTING_MAX_SHARDS ? SCRIPTING_MAX_SHARDS : (uint32_t)shards;
+    }
+
+    if (!fs_direxists("scripts")) {
+        result_t res;
+        if (!(res = fs_mkdir("scripts")).is_ok) {
+            console_error("Failed to create scripts folder. Are permissions configured correctly?");
+            result_discard(res);
+            exit(-1);
+        }
+    }
+
+    fs_recurse("scripts", (void (*)(const char *, void *))scripting_api_load_file, out);
 
     return result_ok();
 }
@@ -65,11 +278,11 @@ void scripting_api_init_globals(scripting_api_t *self) {
     mutex_lock(self->mutex);
 
     lua_newtable(self->lua_state);
+    lua_pushvalue(self->lua_state, -1);
     lua_setglobal(self->lua_state, "net");
-    lua_getglobal(self->lua_state, "net");
 
     lua_newtable(self->lua_state);
-    lua_setfield(self->lua_state, -2, "events");
+    lua_setfield(self->lua_state, -2, "messages");
 
     lua_newtable(self->lua_state);
     lua_setfield(self->lua_state, -2, "config");
@@ -77,17 +290,35 @@ void scripting_api_init_globals(scripting_api_t *self) {
     lua_newtable(self->lua_state);
     lua_setfield(self->lua_state, -2, "clients");
 
-    lua_pop(self->lua_state, 1);
+    // Handlers are cached, so net.events is read through net's metatable and sees every assignment and replacement
+    self->events = LUA_NOREF;
+    lua_newtable(self->lua_state);
+    lua_newtable(self->lua_state);
+    scripting_api_events_wrap(self, -1);
+    lua_setfield(self->lua_state, -2, "events");
+    lua_newtable(self->lua_state);
+    lua_pushvalue(self->lua_state, -2);
+    lua_setfield(self->lua_state, -2, "__index");
+    lua_pushlightuserdata(self->lua_state, self);
+    lua_pushvalue(self->lua_state, -3);
+    lua_pushcclosure(self->lua_state, scripting_api_net_newindex, 2);
+    lua_setfield(self->lua_state, -2, "__newindex");
+    lua_setmetatable(self->lua_state, -3);
+    lua_pop(self->lua_state, 2);
 
     mutex_release(self->mutex);
 }
 
 void scripting_api_cleanup(scripting_api_t *self) {
     mutex_lock(self->mutex);
+    scripting_refs_delete(self->lua_state, &self->handlers);
+    scripting_refs_delete(self->lua_state, &self->misses);
+    scripting_refs_delete(self->lua_state, &self->clients);
     lua_close(self->lua_state);
     mutex_release(self->mutex);
 
-    mutex_delete(self);
+    mutex_delete(self->mutex);
+    mutex_delete(self->inbox_mutex);
 }
 
 void scripting_api_load_file(const char *name, scripting_api_t *self) {
@@ -98,10 +329,29 @@ void scripting_api_load_file(const char *name, scripting_api_t *self) {
         mutex_release(self->mutex);
         exit(-1);
     }
-    console_log("Loaded event '%s'", name);
+    if (!self->shard)
+        console_log("Loaded event '%s'", name);
     mutex_release(self->mutex);
 }
 
+scripting_api_t *scripting_shard_for(uint64_t handle) {
+    // Slots are reused as soon as they are freed, which keeps shards about evenly filled
+    return scripting_shards.list[(uint32_t)handle % scripting_shards.count];
+}
+
+scripting_api_t *scripting_shard_of(lua_State *L) {
+    // Coroutines share their main thread's registry, which is what identifies a state
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+    lua_State *main = lua_tothread(L, -1);
+    lua_pop(L, 1);
+
+    for (uint32_t i = 0; i < scripting_shards.count; ++i) {
+        if (scripting_shards.list[i] && scripting_shards.list[i]->lua_state == main)
+            return scripting_shards.list[i];
+    }
+    return nullptr;
+}
+
 result_t scripting_api_config_number(scripting_api_t *self, const char *name, float *out, float def) {
     mutex_lock(self->mutex);
 
@@ -146,156 +396,387 @@ result_t scripting_api_config_string(scripting_api_t *self, const char *name, ch
     return result_ok();
 }
 
-void scripting_api_create_client(scripting_api_t *self, char *uuid, struct sockaddr_in addr, discord_id_t account, const char *username) {
+result_t scripting_api_config_numbers(scripting_api_t *self, const char *name, hashtable_t *out) {
     mutex_lock(self->mutex);
 
     lua_getglobal(self->lua_state, "net");
-    lua_getfield(self->lua_state, -1, "clients");
-    lua_getfield(self->lua_state, -1, uuid);
-    if (lua_istable(self->lua_state, -1)) {
-        lua_settop(self->lua_state, 0);
+    lua_getfield(self->lua_state, -1, "config");
+    lua_getfield(self->lua_state, -1, name);
+
+    if (lua_isnil(self->lua_state, -1)) {
+        lua_pop(self->lua_state, 3);
         mutex_release(self->mutex);
-        return;
+        return result_ok();
     }
-    lua_pop(self->lua_state, 1);
 
-    lua_newtable(self->lua_state);
+    if (!lua_istable(self->lua_state, -1)) {
+        lua_pop(self->lua_state, 3);
+        mutex_release(self->mutex);
+        return result_error("Config value '%s' should be a table.", name);
+    }
 
-    lua_pushstring(self->lua_state, uuid);
-    lua_setfield(self->lua_state, -2, "uuid");
+    lua_pushnil(self->lua_state);
+    while (lua_next(self->lua_state, -2)) {
+        if (lua_type(self->lua_state, -2) == LUA_TSTRING && lua_isnumber(self->lua_state, -1)) {
+            float value = lua_tonumber(self->lua_state, -1);
+            hashtable_insert(out, (void *)lua_tostring(self->lua_state, -2), &value, sizeof(float));
+        } else {
+            console_warn("Config value '%s' should only contain named numbers.", name);
+        }
+        lua_pop(self->lua_state, 1);
+    }
+    lua_pop(self->lua_state, 3);
 
-    lua_pushstring(self->lua_state, inet_ntoa(addr.sin_addr));
-    lua_setfield(self->lua_state, -2, "ip");
+    mutex_release(self->mutex);
 
-    lua_pushnumber(self->lua_state, ntohs(addr.sin_port));
-    lua_setfield(self->lua_state, -2, "port");
+    return result_ok();
+}
 
-    lua_pushnumber(self->lua_state, account);
-    lua_setfield(self->lua_state, -2, "account");
+static void scripting_api_drain(scripting_api_t *self);
 
-    lua_pushstring(self->lua_state, username);
-    lua_setfield(self->lua_state, -2, "username");
+/// Take a shard for the calling thread, which must not be running one, and catch up on its inbox.
+static void scripting_api_enter(scripting_api_t *self) {
+    mutex_lock(self->mutex);
+    scripting_running = self;
+    scripting_api_drain(self);
+}
 
-    lua_setfield(self->lua_state, -2, uuid);
+/// Give up the shard the thread is running, then run what it queued for shards nobody holds.
+static void scripting_api_leave(scripting_api_t *self) {
+    scripting_api_drain(self);
+    scripting_running = nullptr;
+    mutex_release(self->mutex);
+
+    // Whoever queued while the shard was held left it to the holder, so its inbox is checked again once released
+    uint64_t woken = scripting_woken | 1ull << self->shard;
+    scripting_woken = 0;
+    while (woken) {
+        scripting_api_t *shard = scripting_shards.list[__builtin_ctzll(woken)];
+        woken &= woken - 1;
+
+        // A shard that is busy drains its inbox before it is released
+        if (shard->inbox_count && WaitForSingleObject(shard->mutex, 0) == WAIT_OBJECT_0) {
+            scripting_running = shard;
+            scripting_api_leave(shard);
+        }
+    }
+}
+
+/// Queue a message for a shard, taking ownership of it.
+static void scripting_api_post(scripting_api_t *self, scripting_message_e kind, const char *uuid, intermediate_t *intermediate, uint32_t from) {
+    scripting_message_t *message = malloc(sizeof(scripting_message_t));
+    *message = (scripting_message_t) {
+        .kind = kind,
+        .uuid = uuid ? _strdup(uuid) : nullptr,
+        .intermediate = intermediate,
+        .from = from,
+    };
+
+    mutex_lock(self->inbox_mutex);
+    if (self->inbox_tail)
+        self->inbox_tail->next = message;
+    else
+        self->inbox_head = message;
+    self->inbox_tail = message;
+    InterlockedIncrement(&self->inbox_count);
+    mutex_release(self->inbox_mutex);
+
+    // Threads running a script never wait on another shard, they try it once they stop
+    if (scripting_running)
+        scripting_woken |= 1ull << self->shard;
+    else if (WaitForSingleObject(self->mutex, 0) == WAIT_OBJECT_0) {
+        scripting_running = self;
+        scripting_api_leave(self);
+    }
+}
+
+void scripting_api_create_client(scripting_api_t *self, char *uuid, uint64_t handle, struct sockaddr_in addr, discord_id_t account, const char *username) {
+    scripting_api_enter(self);
+
+    lua_getglobal(self->lua_state, "net");
+    lua_getfield(self->lua_state, -1, "clients");
     lua_getfield(self->lua_state, -1, uuid);
+    if (!lua_istable(self->lua_state, -1)) {
+        lua_pop(self->lua_state, 1);
+
+        lua_newtable(self->lua_state);
+
+        lua_pushstring(self->lua_state, uuid);
+        lua_setfield(self->lua_state, -2, "uuid");
+
+        lua_pushinteger(self->lua_state, (lua_Integer)handle);
+        lua_setfield(self->lua_state, -2, "handle");
+
+        lua_pushstring(self->lua_state, inet_ntoa(addr.sin_addr));
+        lua_setfield(self->lua_state, -2, "ip");
+
+        lua_pushnumber(self->lua_state, ntohs(addr.sin_port));
+        lua_setfield(self->lua_state, -2, "port");
+
+        lua_pushnumber(self->lua_state, account);
+        lua_setfield(self->lua_state, -2, "account");
+
+        lua_pushstring(self->lua_state, username);
+        lua_setfield(self->lua_state, -2, "username");
+
+        lua_setfield(self->lua_state, -2, uuid);
+        lua_getfield(self->lua_state, -1, uuid);
+    }
+
+    // Events find the table through its reference rather than walking net.clients
+    uint32_t hash = jhash_str(uuid);
+    if (!scripting_refs_find(&self->clients, uuid, hash))
+        scripting_refs_insert(&self->clients, uuid, hash, luaL_ref(self->lua_state, LUA_REGISTRYINDEX));
 
     lua_settop(self->lua_state, 0);
 
-    mutex_release(self->mutex);
+    scripting_api_leave(self);
 }
 
-void scripting_api_delete_client(scripting_api_t *self, char *uuid) {
-    mutex_lock(self->mutex);
-
+/// Remove a client from net.clients, the shard must be held.
+static void scripting_api_run_delete_client(scripting_api_t *self, const char *uuid) {
     lua_getglobal(self->lua_state, "net");
     lua_getfield(self->lua_state, -1, "clients");
     lua_pushnil(self->lua_state);
     lua_setfield(self->lua_state, -2, uuid);
+    lua_settop(self->lua_state, 0);
 
-    lua_getfield(self->lua_state, -1, uuid);
-    if (!lua_isnil(self->lua_state, -1)) {
-        console_error("what");
+    scripting_refs_remove(self->lua_state, &self->clients, uuid);
+}
+
+void scripting_api_delete_client(scripting_api_t *self, char *uuid) {
+    if (scripting_running) {
+        scripting_api_post(self, SCRIPTING_MESSAGE_DELETE_CLIENT, uuid, nullptr, 0);
+        return;
     }
 
-    mutex_release(self->mutex);
+    scripting_api_enter(self);
+    scripting_api_run_delete_client(self, uuid);
+    scripting_api_leave(self);
 }
 
-result_t scripting_api_try_event(scripting_api_t *self, intermediate_t *intermediate, char *uuid) {
-    mutex_lock(self->mutex);
+/// Push the handler of an event type, returns false if there is none.
+/// Handlers and their absence are cached, so only the first miss of a type is reported in res, which may be nullptr.
+static bool scripting_api_push_handler(scripting_api_t *self, const char *type, result_t *res) {
+    uint32_t hash = jhash_str(type);
+    scripting_ref_t *handler = scripting_refs_find(&self->handlers, type, hash);
+    if (handler) {
+        lua_rawgeti(self->lua_state, LUA_REGISTRYINDEX, handler->ref);
+        return true;
+    }
+    if (scripting_refs_find(&self->misses, type, hash))
+        return false;
+
+    bool found = false;
+    if (self->events != LUA_NOREF) {
+        lua_rawgeti(self->lua_state, LUA_REGISTRYINDEX, self->events);
+        lua_getfield(self->lua_state, -1, type);
+        lua_remove(self->lua_state, -2);
+        if (!(found = lua_isfunction(self->lua_state, -1)))
+            lua_pop(self->lua_state, 1);
+    }
 
-    lua_getglobal(self->lua_state, "net");
-    lua_getfield(self->lua_state, -1, "events");
-    lua_getfield(self->lua_state, -1, intermediate->type);
-    if (!lua_isfunction(self->lua_state, -1)) {
-        mutex_release(self->mutex);
-        lua_settop(self->lua_state, 0);
-        return result_error("Unable to locate event '%s'", intermediate->type);
+    if (found) {
+        // Clients can make up any amount of types, past the limit they are looked up every time
+        if (self->handlers.count < SCRIPTING_MAX_HANDLERS) {
+            lua_pushvalue(self->lua_state, -1);
+            scripting_refs_insert(&self->handlers, type, hash, luaL_ref(self->lua_state, LUA_REGISTRYINDEX));
+        }
+        return true;
     }
 
+    // Misses are only keys, a full set starts over rather than growing
+    if (self->misses.count >= SCRIPTING_MAX_HANDLERS)
+        scripting_refs_clear(self->lua_state, &self->misses);
+    scripting_refs_insert(&self->misses, type, hash, LUA_REFNIL);
+
+    if (res)
+        *res = self->events == LUA_NOREF ? result_error("net.events isn't a table.") : result_error("Unable to locate event '%s'", type);
+    return false;
+}
+
+/// Push the handler of an event and the table it is called with, filled with the event's header.
+/// Returns false with the stack cleared if either can't be found, res is left ok for events already known to be missing.
+static bool scripting_api_begin_event(scripting_api_t *self, const char *type, uint32_t id, uint32_t reply, const char *uuid, result_t *res) {
+    if (!scripting_api_push_handler(self, type, res))
+        return false;
+
     lua_newtable(self->lua_state);
 
-    lua_getglobal(self->lua_state, "net");
-    lua_getfield(self->lua_state, -1, "clients");
-    lua_getfield(self->lua_state, -1, uuid);
-    if (!lua_istable(self->lua_state, -1)) {
-        mutex_release(self->mutex);
+    scripting_ref_t *client = scripting_refs_find(&self->clients, uuid, jhash_str(uuid));
+    if (!client) {
         lua_settop(self->lua_state, 0);
-        return result_error("Unable to locate client '%s'", uuid);
+        *res = result_error("Unable to locate client '%s'", uuid);
+        return false;
     }
-    lua_remove(self->lua_state, -2);
-    lua_remove(self->lua_state, -2);
+    lua_rawgeti(self->lua_state, LUA_REGISTRYINDEX, client->ref);
     lua_setfield(self->lua_state, -2, "client");
 
-    lua_pushnumber(self->lua_state, (double)intermediate->id);
+    lua_pushnumber(self->lua_state, (double)id);
     lua_setfield(self->lua_state, -2, "id");
-    lua_pushnumber(self->lua_state, intermediate->reply);
+    lua_pushnumber(self->lua_state, reply);
     lua_setfield(self->lua_state, -2, "reply");
-    lua_pushstring(self->lua_state, intermediate->type);
+    lua_pushstring(self->lua_state, type);
     lua_setfield(self->lua_state, -2, "type");
 
-    intermediate_variable_t *head = intermediate->variables;
-    while (head) {
-        switch (head->type) {
-            case INTERMEDIATE_STRING:
-                lua_pushstring(self->lua_state, head->value);
-                lua_setfield(self->lua_state, -2, head->name);
-                break;
-
-            case INTERMEDIATE_S8:
-                lua_pushnumber(self->lua_state, *(int8_t *)head->value);
-                lua_setfield(self->lua_state, -2, head->name);
-                break;
-            case INTERMEDIATE_S16:
-                lua_pushnumber(self->lua_state, *(int16_t *)head->value);
-                lua_setfield(self->lua_state, -2, head->name);
-                break;
-            case INTERMEDIATE_S32:
-                lua_pushnumber(self->lua_state, *(int32_t *)head->value);
-                lua_setfield(self->lua_state, -2, head->name);
-                break;
-            case INTERMEDIATE_S64:
-                lua_pushnumber(self->lua_state, *(int64_t *)head->value);
-                lua_setfield(self->lua_state, -2, head->name);
-                break;
-
-            case INTERMEDIATE_U8:
-                lua_pushnumber(self->lua_state, *(uint8_t *)head->value);
-                lua_setfield(self->lua_state, -2, head->name);
-                break;
-            case INTERMEDIATE_U16:
-                lua_pushnumber(self->lua_state, *(uint16_t *)head->value);
-                lua_setfield(self->lua_state, -2, head->name);
-                break;
-            case INTERMEDIATE_U32:
-                lua_pushnumber(self->lua_state, *(uint32_t *)head->value);
-                lua_setfield(self->lua_state, -2, head->name);
-                break;
-            case INTERMEDIATE_U64:
-                lua_pushnumber(self->lua_state, *(uint64_t *)head->value);
-                lua_setfield(self->lua_state, -2, head->name);
-                break;
-
-            case INTERMEDIATE_F32:
-                lua_pushnumber(self->lua_state, *(float *)head->value);
-                lua_setfield(self->lua_state, -2, head->name);
-                break;
-            case INTERMEDIATE_F64:
-                lua_pushnumber(self->lua_state, *(double *)head->value);
-                lua_setfield(self->lua_state, -2, head->name);
-                break;
-        }
-        head = head->next;
-    }
+    return true;
+}
+
+/// Set a field of the table on top of the stack to a variable's value, which may be unaligned.
+static void scripting_api_set_variable(lua_State *L, const char *name, intermediate_type_e type, const void *value) {
+    double number;
+    if (type == INTERMEDIATE_STRING)
+        lua_pushstring(L, value);
+    else if (type == INTERMEDIATE_BYTES) {
+        uint16_t len;
+        memcpy(&len, value, sizeof(uint16_t));
+        lua_pushlstring(L, (const char *)value + INTERMEDIATE_BYTES_HEADER_SIZE, len);
+    } else if (type == INTERMEDIATE_ARRAY)
+        api_arrays_push(L, value);
+    else if (intermediate_read_number(type, value, &number))
+        lua_pushnumber(L, number);
+    else
+        return;
+    lua_setfield(L, -2, name);
+}
 
+/// Call the handler pushed by scripting_api_begin_event.
+static result_t scripting_api_call_event(scripting_api_t *self) {
     if (lua_pcall(self->lua_state, 1, 0, 0) != LUA_OK) {
-        mutex_release(self->mutex);
         result_t res = result_error(lua_tostring(self->lua_state, -1));
         lua_settop(self->lua_state, 0);
         return res;
     }
 
     lua_settop(self->lua_state, 0);
-
-    mutex_release(self->mutex);
     return result_ok();
-}
\ No newline at end of file
+}
+
+/// Call an event's handler, the shard must be held.
+static result_t scripting_api_run_event(scripting_api_t *self, intermediate_t *intermediate, const char *uuid) {
+    result_t res = result_ok();
+    if (!scripting_api_begin_event(self, intermediate->type, intermediate->id, intermediate->reply, uuid, &res))
+        return res;
+
+    for (intermediate_variable_t *head = intermediate->variables; head; head = head->next)
+        scripting_api_set_variable(self->lua_state, head->name, head->type, head->value);
+
+    return scripting_api_call_event(self);
+}
+
+/// Call the net.messages handler of a shard message, the shard must be held.
+static result_t scripting_api_run_message(scripting_api_t *self, intermediate_t *intermediate, uint32_t from) {
+    lua_getglobal(self->lua_state, "net");
+    lua_getfield(self->lua_state, -1, "messages");
+    lua_getfield(self->lua_state, -1, intermediate->type);
+    if (!lua_isfunction(self->lua_state, -1)) {
+        lua_settop(self->lua_state, 0);
+        return result_error("Unable to locate message '%s'", intermediate->type);
+    }
+
+    lua_newtable(self->lua_state);
+    for (intermediate_variable_t *head = intermediate->variables; head; head = head->next)
+        scripting_api_set_variable(self->lua_state, head->name, head->type, head->value);
+    lua_pushinteger(self->lua_state, from);
+    lua_setfield(self->lua_state, -2, "shard");
+    lua_pushstring(self->lua_state, intermediate->type);
+    lua_setfield(self->lua_state, -2, "type");
+
+    return scripting_api_call_event(self);
+}
+
+/// Run everything queued for a shard, including what it queues for itself meanwhile.
+static void scripting_api_drain(scripting_api_t *self) {
+    while (self->inbox_count) {
+        mutex_lock(self->inbox_mutex);
+        scripting_message_t *message = self->inbox_head;
+        self->inbox_head = self->inbox_tail = nullptr;
+        InterlockedExchange(&self->inbox_count, 0);
+        mutex_release(self->inbox_mutex);
+
+        while (message) {
+            result_t res = result_ok();
+            if (message->kind == SCRIPTING_MESSAGE_EVENT)
+                res = scripting_api_run_event(self, message->intermediate, message->uuid);
+            else if (message->kind == SCRIPTING_MESSAGE_DELETE_CLIENT)
+                scripting_api_run_delete_client(self, message->uuid);
+            else
+                res = scripting_api_run_message(self, message->intermediate, message->from);
+            if (!res.is_ok) {
+                console_error(res.description);
+                result_discard(res);
+            }
+
+            scripting_message_t *next = message->next;
+            if (message->intermediate)
+                intermediate_delete(message->intermediate);
+            free(message->uuid);
+            free(message);
+            message = next;
+        }
+    }
+}
+
+result_t scripting_api_try_event(scripting_api_t *self, intermediate_t *intermediate, char *uuid) {
+    if (scripting_running) {
+        scripting_api_post(self, SCRIPTING_MESSAGE_EVENT, uuid, intermediate_copy(intermediate), 0);
+        return result_ok();
+    }
+
+    scripting_api_enter(self);
+    result_t res = scripting_api_run_event(self, intermediate, uuid);
+    scripting_api_leave(self);
+    return res;
+}
+
+result_t scripting_api_try_event_view(scripting_api_t *self, const intermediate_view_t *view, char *uuid) {
+    result_t res;
+    if (scripting_running) {
+        intermediate_t *intermediate;
+        if (!(res = intermediate_from_buffer((char *)view->buffer, view->len, &intermediate)).is_ok)
+            return res;
+        scripting_api_post(self, SCRIPTING_MESSAGE_EVENT, uuid, intermediate, 0);
+        return result_ok();
+    }
+
+    scripting_api_enter(self);
+    res = result_ok();
+    if (!scripting_api_begin_event(self, view->type, view->id, view->reply, uuid, &res)) {
+        scripting_api_leave(self);
+        return res;
+    }
+
+    // Schema frames are a fixed layout, every field is at a known offset
+    if (view->schema) {
+        for (uint32_t i = 0; i < view->schema->field_count; ++i) {
+            const schema_field_t *field = &view->schema->fields[i];
+            scripting_api_set_variable(self->lua_state, field->name, field->type, view->variables + field->offset);
+        }
+    } else {
+        // Variables are read straight out of the frame
+        intermediate_view_var_t var;
+        for (const char *cursor = view->variables; intermediate_view_next(view, &cursor, &var);)
+            scripting_api_set_variable(self->lua_state, var.name, var.type, var.value);
+    }
+
+    res = scripting_api_call_event(self);
+    scripting_api_leave(self);
+    return res;
+}
+
+result_t scripting_api_try_tick(scripting_api_t *self, double dt) {
+    scripting_api_enter(self);
+    if (!scripting_api_push_handler(self, "tick", nullptr)) {
+        scripting_api_leave(self);
+        return result_ok();
+    }
+
+    lua_pushnumber(self->lua_state, dt);
+    result_t res = scripting_api_call_event(self);
+    scripting_api_leave(self);
+    return res;
+}
+
+void scripting_api_send(scripting_api_t *self, intermediate_t *intermediate, uint32_t from) {
+    scripting_api_post(self, SCRIPTING_MESSAGE_SHARD, nullptr, intermediate, from);
+}
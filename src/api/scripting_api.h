@@ -3,34 +3,124 @@
 #include "../data/result.h"
 #include "../data/mutex.h"
 #include "../net/discord.h"
+#include "../data/hashtable.h"
 #include <lua.h>
 #include <winsock2.h>
 
 #define DEFAULT_CONFIG "\
-net.config.tcp_port = 5060\
-net.config.udp_port = 5060\
-net.config.http_port = 80\
-\
-net.config.max_players = 512\
-\
-net.config.accounts_enabled = false\
+net.config.tcp_port = 5060\n\
+net.config.udp_port = 5060\n\
+net.config.http_port = 80\n\
+\n\
+net.config.max_players = 512\n\
+net.config.workers = 0\n\
+net.config.udp_workers = 0\n\
+net.config.tick_rate = 0\n\
+\n\
+net.config.grid_cell_size = 64\n\
+net.config.interest_radius = 128\n\
+\n\
+net.config.compression_level = 0\n\
+net.config.compression_threshold = 128\n\
+net.config.compression_dictionary = \"\"\n\
+\n\
+net.config.rate_limit = 30\n\
+net.config.rate_burst = 10\n\
+net.config.rate_policy = \"drop\"\n\
+\n\
+net.config.send_queue = 256\n\
+net.config.slow_policy = \"drop\"\n\
+\n\
+net.config.script_shards = 1\n\
+\n\
+net.config.accounts_enabled = false\n\
 "
 
+/// Most scripting shards.
+#define SCRIPTING_MAX_SHARDS 64
+
+/// Most event types whose handler is cached per shard, and most remembered as having none before those start over.
+#define SCRIPTING_MAX_HANDLERS 1024
+
+typedef struct scripting_message_t scripting_message_t;
+
+/// Registry reference to a Lua value, keyed by a string.
+typedef struct scripting_ref_t {
+    char *key;
+    uint32_t hash;
+    // LUA_REFNIL when only the key is remembered
+    int ref;
+} scripting_ref_t;
+
+/// Open addressing map of registry references, only touched while the shard is held.
+typedef struct scripting_refs_t {
+    scripting_ref_t *slots;
+    // Used counts removed slots as well, they are only cleared by a rebuild
+    uint32_t capacity, used, count;
+} scripting_refs_t;
+
+/// One Lua state running every script, see scripting_shards_t.
 typedef struct scripting_api_t {
     lua_State *lua_state;
     mutex_t mutex;
+    // Position in scripting_shards
+    uint32_t shard;
+
+    // Handlers of net.events by type, dropped whenever net.events is assigned to or replaced
+    scripting_refs_t handlers;
+    // Event types net.events had no handler for, so each is only looked up and reported once
+    scripting_refs_t misses;
+    // Registry reference to the table net.events reads from, LUA_NOREF if net.events isn't a table.
+    // net.events itself is kept empty so every assignment is seen
+    int events;
+    // Tables of net.clients by uuid
+    scripting_refs_t clients;
+
+    // Work waiting for the shard, run by whichever thread holds it next
+    mutex_t inbox_mutex;
+    scripting_message_t *inbox_head, *inbox_tail;
+    volatile LONG inbox_count;
 } scripting_api_t;
 
-result_t scripting_api_new(scripting_api_t *out);
+/// Independent Lua states that each load every script, clients are spread over them by handle.
+/// A thread runs one shard at a time, anything it asks of a shard while running is queued instead of run.
+typedef struct scripting_shards_t {
+    scripting_api_t *list[SCRIPTING_MAX_SHARDS];
+    uint32_t count;
+    // Every shard has loaded its scripts, messages can only be sent from here on
+    bool ready;
+} scripting_shards_t;
+
+extern scripting_shards_t scripting_shards;
+
+/// Create a shard and load every script into it.
+/// The first shard reads the amount of shards from the config, so it must be created before the others.
+result_t scripting_api_new(scripting_api_t *out, uint32_t shard);
 void scripting_api_init_globals(scripting_api_t *self);
 void scripting_api_cleanup(scripting_api_t *self);
 
 void scripting_api_load_file(const char *name, scripting_api_t *self);
 
+/// Shard of the client with a handle.
+scripting_api_t *scripting_shard_for(uint64_t handle);
+/// Find the shard a Lua state belongs to, returns nullptr if none does.
+scripting_api_t *scripting_shard_of(lua_State *L);
+
 result_t scripting_api_config_number(scripting_api_t *self, const char *name, float *out, float def);
 result_t scripting_api_config_string(scripting_api_t *self, const char *name, char **out, char *def);
+/// Read a config table of named numbers into a hashtable of floats.
+/// A missing table leaves the hashtable untouched.
+result_t scripting_api_config_numbers(scripting_api_t *self, const char *name, hashtable_t *out);
 
-void scripting_api_create_client(scripting_api_t *self, char *uuid, struct sockaddr_in addr, discord_id_t account, const char *username);
+/// Add a client to its shard's net.clients, never called while the thread runs a script.
+void scripting_api_create_client(scripting_api_t *self, char *uuid, uint64_t handle, struct sockaddr_in addr, discord_id_t account, const char *username);
 void scripting_api_delete_client(scripting_api_t *self, char *uuid);
 
-result_t scripting_api_try_event(scripting_api_t *self, intermediate_t *intermediate, char *uuid);
\ No newline at end of file
+result_t scripting_api_try_event(scripting_api_t *self, intermediate_t *intermediate, char *uuid);
+/// Call an event's handler with the variables of a frame read in place.
+result_t scripting_api_try_event_view(scripting_api_t *self, const intermediate_view_t *view, char *uuid);
+/// Call net.events.tick with the seconds since the last tick, if it is defined.
+result_t scripting_api_try_tick(scripting_api_t *self, double dt);
+/// Queue a message for a shard's net.messages handler of its type, taking ownership of the intermediate.
+/// It is handled once no thread runs the shard, after the sending thread's own script returns.
+void scripting_api_send(scripting_api_t *self, intermediate_t *intermediate, uint32_t from);
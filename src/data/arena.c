@@ -0,0 +1,37 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGNMENT 8
+
+arena_t *arena_new(uint64_t capacity) {
+    arena_t *arena = malloc(sizeof(arena_t) + capacity);
+    arena->capacity = capacity;
+    arena->used = 0;
+    return arena;
+}
+
+void arena_delete(arena_t *self) {
+    free(self);
+}
+
+void *arena_alloc(arena_t *self, uint64_t size) {
+    uint64_t start = (self->used + ARENA_ALIGNMENT - 1) & ~(uint64_t)(ARENA_ALIGNMENT - 1);
+    if (start + size > self->capacity)
+        return nullptr;
+
+    self->used = start + size;
+    return memset(self->data + start, 0, size);
+}
+
+char *arena_strdup(arena_t *self, const char *string) {
+    uint64_t len = strlen(string) + 1;
+    char *copy = arena_alloc(self, len);
+    if (copy)
+        memcpy(copy, string, len);
+    return copy;
+}
+
+void arena_reset(arena_t *self) {
+    self->used = 0;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Bump allocator over a single fixed allocation.
+/// Allocations are only ever released all at once, by resetting or deleting the arena.
+typedef struct arena_t {
+    uint64_t capacity, used;
+    alignas(max_align_t) char data[];
+} arena_t;
+
+/// Create an arena able to hold capacity bytes, in one allocation.
+arena_t *arena_new(uint64_t capacity);
+/// Free an arena and everything allocated in it.
+void arena_delete(arena_t *self);
+
+/// Allocate zeroed, 8 byte aligned memory from the arena.
+/// Returns nullptr if the arena is full.
+void *arena_alloc(arena_t *self, uint64_t size);
+/// Copy a string into the arena, returns nullptr if the arena is full.
+char *arena_strdup(arena_t *self, const char *string);
+/// Release everything allocated in the arena so it can be reused.
+void arena_reset(arena_t *self);
@@ -71,7 +71,8 @@ void hashtable_delete(hashtable_t *this) {
     }
     mutex_release(this->mutex);
 
-    mutex_delete(this);
+    free(this->buckets);
+    mutex_delete(this->mutex);
 }
 
 void hashtable_reset(hashtable_t *this) {
@@ -95,7 +96,7 @@ void *hashtable_insert(hashtable_t *this, void *key, void *value, uint32_t size)
     }
     mutex_release(this->mutex);
 
-    return this->buckets[hash].pair->value;
+    return pair->value;
 }
 
 void *hashtable_get(hashtable_t *this, void *key) {
@@ -115,12 +116,10 @@ void *hashtable_get(hashtable_t *this, void *key) {
 pair_t **hashtable_pairs(hashtable_t *this, uint32_t *count) {
     mutex_lock(this->mutex);
     *count = 0;
-    pair_t **pairs = nullptr;
+    pair_t **pairs = malloc((this->pair_count ? this->pair_count : 1) * sizeof(pair_t *));
     for (bucket_t *buck = this->buckets; buck < this->buckets + this->bucket_count; ++buck) {
-        for (pair_t *pair = buck->pair; pair != nullptr; pair = pair->next) {
-            pairs = realloc(pairs, (++*count) * sizeof(pair_t *));
-            pairs[*count - 1] = pair;
-        }
+        for (pair_t *pair = buck->pair; pair != nullptr && *count < this->pair_count; pair = pair->next)
+            pairs[(*count)++] = pair;
     }
     mutex_release(this->mutex);
 
@@ -131,7 +130,7 @@ void hashtable_remove(hashtable_t *this, void *key) {
     mutex_lock(this->mutex);
     uint32_t hash = hashtable_hash(this, key) & (this->bucket_count - 1);
     for (pair_t *pair = this->buckets[hash].pair; pair != nullptr; pair = pair->next) {
-        if (this->key_size == -1 ? bstrcmp(key, pair->key) : memcmp(key, pair->key, this->key_size)) {
+        if (this->key_size == -1 ? bstrcmp(key, pair->key) : memcmp(key, pair->key, this->key_size) == 0) {
             if (pair == this->buckets[hash].pair)
                 this->buckets[hash].pair = pair->next;
             pair_delete(pair);
@@ -139,7 +138,7 @@ void hashtable_remove(hashtable_t *this, void *key) {
 
             if (hashtable_calculate_load(this, this->bucket_count / 2) <= HASHTABLE_LOAD_CAP && this->bucket_count > HASHTABLE_DEFAULT_SIZE) {
                 mutex_release(this->mutex);
-                hashtable_rehash(this, this->bucket_count * 2);
+                hashtable_rehash(this, this->bucket_count / 2);
                 mutex_lock(this->mutex);
             }
             break;
@@ -159,7 +158,9 @@ void hashtable_rehash(hashtable_t *this, uint64_t count) {
 
     // Rehash process
     for (bucket_t *bucket = old_buckets; bucket < old_buckets + this->bucket_count; ++bucket) {
-        for (pair_t *pair = bucket->pair; pair != nullptr; pair = pair->next) {
+        for (pair_t *pair = bucket->pair, *next; pair != nullptr; pair = next) {
+            next = pair->next;
+            pair->previous = pair->next = nullptr;
             uint32_t hash = hashtable_hash(this, pair->key) & (count - 1);
             this->buckets[hash].pair = pair_push(this->buckets[hash].pair, pair);
         }
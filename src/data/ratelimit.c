@@ -0,0 +1,37 @@
+#include "ratelimit.h"
+#include <math.h>
+
+ratelimit_t ratelimit_new(float rate, float burst) {
+    if (burst < 1)
+        burst = 1;
+    return (ratelimit_t) {
+        .rate = rate,
+        .burst = burst,
+        .tokens = burst,
+        .last = 0,
+    };
+}
+
+bool ratelimit_take(ratelimit_t *self, uint64_t now) {
+    if (self->rate <= 0)
+        return true;
+
+    // Refill
+    if (self->last && now > self->last) {
+        self->tokens += (now - self->last) * self->rate / 1000.0f;
+        if (self->tokens > self->burst)
+            self->tokens = self->burst;
+    }
+    self->last = now;
+
+    if (self->tokens < 1)
+        return false;
+    self->tokens -= 1;
+    return true;
+}
+
+uint64_t ratelimit_wait(ratelimit_t *self) {
+    if (self->rate <= 0 || self->tokens >= 1)
+        return 0;
+    return (uint64_t)ceilf((1 - self->tokens) * 1000.0f / self->rate);
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Token bucket, refilled at rate tokens per second up to burst tokens.
+/// A rate of 0 never limits.
+typedef struct ratelimit_t {
+    float rate, burst;
+    float tokens;
+    uint64_t last;
+} ratelimit_t;
+
+/// Create a full token bucket.
+ratelimit_t ratelimit_new(float rate, float burst);
+
+/// Take a token if one is available at time now, in milliseconds.
+/// Returns whether a token was taken.
+bool ratelimit_take(ratelimit_t *self, uint64_t now);
+/// Milliseconds until the next token is available.
+uint64_t ratelimit_wait(ratelimit_t *self);
@@ -0,0 +1,79 @@
+#include "ring.h"
+#include <stdlib.h>
+#include <string.h>
+
+ring_t ring_new(uint64_t capacity) {
+    return (ring_t) {
+        .data = calloc(1, capacity),
+        .capacity = capacity,
+        .head = 0,
+        .tail = 0,
+    };
+}
+
+void ring_delete(ring_t *self) {
+    free(self->data);
+    *self = (ring_t) { 0 };
+}
+
+uint64_t ring_size(ring_t *self) {
+    return self->tail - self->head;
+}
+
+uint64_t ring_space(ring_t *self) {
+    return self->capacity - ring_size(self);
+}
+
+char *ring_read_span(ring_t *self, uint64_t *len) {
+    uint64_t start = self->head & (self->capacity - 1);
+    uint64_t size = ring_size(self);
+    *len = size < self->capacity - start ? size : self->capacity - start;
+    return self->data + start;
+}
+
+int ring_write_spans(ring_t *self, char *spans[2], uint64_t lens[2]) {
+    uint64_t space = ring_space(self);
+    if (!space)
+        return 0;
+
+    uint64_t start = self->tail & (self->capacity - 1);
+    uint64_t first = self->capacity - start;
+    spans[0] = self->data + start;
+    if (space <= first) {
+        lens[0] = space;
+        return 1;
+    }
+
+    lens[0] = first;
+    spans[1] = self->data;
+    lens[1] = space - first;
+    return 2;
+}
+
+uint64_t ring_peek(ring_t *self, char *out, uint64_t len) {
+    uint64_t size = ring_size(self);
+    if (len > size)
+        len = size;
+
+    uint64_t first;
+    char *span = ring_read_span(self, &first);
+    if (first >= len) {
+        memcpy(out, span, len);
+        return len;
+    }
+
+    memcpy(out, span, first);
+    memcpy(out + first, self->data, len - first);
+    return len;
+}
+
+void ring_consume(ring_t *self, uint64_t len) {
+    self->head += len;
+    // Rewind when empty so spans stay as large as possible
+    if (self->head == self->tail)
+        self->head = self->tail = 0;
+}
+
+void ring_commit(ring_t *self, uint64_t len) {
+    self->tail += len;
+}
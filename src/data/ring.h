@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+
+/// Byte ring buffer.
+/// Head and tail only ever grow, the capacity must be a power of two.
+typedef struct ring_t {
+    char *data;
+    uint64_t capacity;
+    uint64_t head, tail;
+} ring_t;
+
+/// Create and allocate a ring buffer.
+ring_t ring_new(uint64_t capacity);
+/// Clean up after a ring buffer.
+void ring_delete(ring_t *self);
+
+/// Amount of bytes waiting to be read.
+uint64_t ring_size(ring_t *self);
+/// Amount of bytes that can still be written.
+uint64_t ring_space(ring_t *self);
+
+/// Get the contiguous readable region at the head.
+char *ring_read_span(ring_t *self, uint64_t *len);
+/// Get up to two writable regions at the tail, returns how many there are.
+int ring_write_spans(ring_t *self, char *spans[2], uint64_t lens[2]);
+
+/// Copy up to len bytes from the head into out without consuming them.
+/// Returns the amount of bytes copied.
+uint64_t ring_peek(ring_t *self, char *out, uint64_t len);
+/// Mark len bytes at the head as read.
+void ring_consume(ring_t *self, uint64_t len);
+/// Mark len bytes at the tail as written.
+void ring_commit(ring_t *self, uint64_t len);
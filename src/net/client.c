@@ -3,8 +3,11 @@
 #include "server.h"
 #include "socket.h"
 #include "../api/intermediate.h"
+#include "../api/schema.h"
 #include "../data/stringext.h"
+#include "packet.h"
 #include "../io/console.h"
+#include "../util/ext.h"
 #include <stdint.h>
 #include <stdlib.h>
 #include <winsock2.h>
@@ -16,20 +19,39 @@ client_t *client_new(SOCKET socket, struct sockaddr_in address) {
         .uuid = client_generate_uuid(),
         .account = 0,
         .mutex = mutex_new(),
+        .references = 1,
+        .state = CLIENT_STATE_CONNECTING,
 
         .socket = socket,
         .address = address,
+
+        .recv_ring = ring_new(CLIENT_RING_SIZE),
+        .frame = calloc(1, MAX_INTERMEDIATE_SIZE),
+
+        .limit = server.rate_limit,
+        .limits = hashtable_string(),
+
+        .queue = calloc(server.send_queue, sizeof(packet_t *)),
+
+        .deltas = hashtable_string(),
     };
 
     if (!client->uuid) {
+        closesocket(socket);
+        client_delete(client);
         return nullptr;
     }
 
-    // Insert into tables
-    hashtable_insert(&server.clients, client->uuid, &client, sizeof(client_t *));
-    char *addr = address_string(address);
-    hashtable_insert(&server.clients_addr, addr, &client, sizeof(client_t *));
-    free(addr);
+    registry_insert(&server.clients, client);
+    client->scripts = scripting_shard_for(client->handle);
+
+    result_t res;
+    if (!(res = engine_attach(&server.engine, socket, client)).is_ok) {
+        console_error(res.description);
+        result_discard(res);
+        client_close(client);
+        return nullptr;
+    }
 
     if (!server.login) {
         char *username = format("Player %s", client->uuid);
@@ -38,48 +60,79 @@ client_t *client_new(SOCKET socket, struct sockaddr_in address) {
     } else {
         intermediate_t *intermediate = intermediate_new("verify", 0);
         intermediate_add_var(intermediate, "url", INTERMEDIATE_STRING, http_server.verify_url, strlen(http_server.verify_url) + 1);
-        result_t res;
-        if (!(res = client_send_intermediate(client, intermediate)).is_ok) {
+        res = client_send_intermediate(client, intermediate);
+        intermediate_delete(intermediate);
+        if (!res.is_ok) {
+            result_discard(res);
             client_kick(client, "Unable to send URI.");
             return nullptr;
         }
     }
 
-    client->thread = CreateThread(nullptr, 0, (LPTHREAD_START_ROUTINE)client_handle, client, 0, nullptr);
+    if (!client_post_recv(client)) {
+        client_close(client);
+        return nullptr;
+    }
 
     return client;
 }
 
 void client_delete(client_t *self) {
-    mutex_lock(self->mutex);
+    mutex_delete(self->mutex);
+    ring_delete(&self->recv_ring);
+    hashtable_delete(&self->limits);
+    for (uint32_t i = 0; i < self->queue_count; ++i)
+        packet_release(self->queue[(self->queue_head + i) % server.send_queue]);
+    free(self->queue);
+    for (uint32_t i = 0; i < CLIENT_UDP_WINDOW; ++i) {
+        if (self->udp_ready & (1ull << i))
+            free((char *)self->udp_parked[i].buffer);
+    }
+    for (uint32_t i = 0; i < self->udp_queued; ++i)
+        packet_release(self->udp_queue[i]);
+
+    uint32_t count = 0;
+    pair_t **pairs = hashtable_pairs(&self->deltas, &count);
+    for (pair_t **pl = pairs; pl < pairs + count; ++pl)
+        delta_cleanup((*pl)->value);
+    free(pairs);
+    hashtable_delete(&self->deltas);
+    if (self->reliable)
+        reliable_delete(self->reliable);
+    free(self->frame);
+    free(self->uuid);
+    free(self);
+}
 
-    // Disconnect Event
-    if (self->account) {
-        result_t res;
-        intermediate_t *intermediate = intermediate_new("disconnect", 0);
-        if (!(res = scripting_api_try_event(&server.api, intermediate, self->uuid)).is_ok) {
-            console_error(res.description);
-            result_discard(res);
-        }
-        intermediate_delete(intermediate);
+void client_retain(client_t *self) {
+    InterlockedIncrement(&self->references);
+}
 
-        scripting_api_delete_client(&server.api, self->uuid);
-    }
-    closesocket(self->socket);
+void client_release(client_t *self) {
+    if (InterlockedDecrement(&self->references) == 0)
+        client_delete(self);
+}
 
-    self->account = 0;
+client_t *client_get(client_handle_t handle) {
+    return registry_get(&server.clients, handle);
+}
 
-    // Remove from tables
-    char *tofree = self->uuid;
-    hashtable_remove(&server.clients, self->uuid);
-    free(tofree);
-    char *addr = address_string(self->address);
-    hashtable_remove(&server.clients_addr, addr);
-    free(addr);
+client_t *client_find(const char *uuid) {
+    return registry_find_uuid(&server.clients, uuid);
+}
 
-    mutex_release(self->mutex);
-    mutex_delete(self->mutex);
-    TerminateThread(self->thread, 0);
+client_t *client_find_address(struct sockaddr_in address) {
+    return registry_find_address(&server.clients, address);
+}
+
+client_t **client_snapshot(uint32_t *count) {
+    return registry_snapshot(&server.clients, count);
+}
+
+void client_snapshot_release(client_t **clients, uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i)
+        client_release(clients[i]);
+    free(clients);
 }
 
 char *client_generate_uuid(void) {
@@ -96,185 +149,490 @@ char *client_generate_uuid(void) {
     return out;
 }
 
-DWORD WINAPI client_handle(client_t *self) {
-    intermediate_control_e cc = INTERMEDIATE_NONE;
-    uint64_t len = 0;
-    char *buffer = calloc(1, MAX_INTERMEDIATE_SIZE);
-    while (true) {
-        if (recv(self->socket, buffer + len, sizeof(char), 0) <= 0) {
-            mutex_release(self->mutex);
-            client_delete(self);
-        }
+bool client_post_recv(client_t *self) {
+    if (self->state == CLIENT_STATE_CLOSING)
+        return false;
+    // Draining clients only wait for their queue to empty
+    if (self->state == CLIENT_STATE_DRAINING)
+        return true;
+
+    // Receive straight into the free space of the ring, wrapping if needed
+    char *spans[2];
+    uint64_t lens[2];
+    int count = ring_write_spans(&self->recv_ring, spans, lens);
+    if (!count)
+        return false;
+    for (int i = 0; i < count; ++i)
+        self->recv_buffers[i] = (WSABUF) { .len = lens[i], .buf = spans[i] };
+
+    self->recv_io = (engine_io_t) { .op = ENGINE_OP_RECV };
+
+    client_retain(self);
+    DWORD flags = 0;
+    if (WSARecv(self->socket, self->recv_buffers, count, nullptr, &flags, &self->recv_io.overlapped, nullptr) == SOCKET_ERROR
+        && WSAGetLastError() != WSA_IO_PENDING) {
+        client_release(self);
+        return false;
+    }
 
-        if (!self->account)
-            continue;
+    return true;
+}
 
-        switch (buffer[len]) {
-            case INTERMEDIATE_HEADER: {
-                mutex_lock(self->mutex);
-                if (cc != INTERMEDIATE_NONE) {
-                    cc = INTERMEDIATE_NONE;
-                    continue;
-                }
+void client_on_recv(client_t *self, DWORD bytes, bool ok) {
+    if (!ok || bytes == 0) {
+        client_close(self);
+        client_release(self);
+        return;
+    }
 
-                cc = INTERMEDIATE_HEADER;
-                len++;
+    ring_commit(&self->recv_ring, bytes);
+    client_read_frames(self);
 
-                // Recieve version and id/reply
-                if (recv(self->socket, buffer + len, sizeof(float) + sizeof(uint32_t) * 2, 0)  <= 0) {
-                    mutex_release(self->mutex);
-                    client_delete(self);
-                    return 0;
-                }
-                len += sizeof(float) + sizeof(uint32_t) * 2;
+    // Deferred clients stop receiving until they are resumed
+    if (!self->deferred && !client_post_recv(self))
+        client_close(self);
+    client_release(self);
+}
 
-                int olen = len;
-                while (true) {
-                    if (recv(self->socket, buffer + len, sizeof(char), 0) == SOCKET_ERROR) {
-                        mutex_release(self->mutex);
-                        client_delete(self);                        return 0;
-                    }
-                    if (buffer[len] == '\0' && olen - len >= MAX_INTERMEDIATE_STRING_LENGTH - 1) {
-                        len++;
-                        break;
-                    }
-                    len++;
-                }
-                break;
-            }
-            case INTERMEDIATE_VARIABLE: {
-                if (cc != INTERMEDIATE_HEADER && cc != INTERMEDIATE_VARIABLE) {
-                    cc = INTERMEDIATE_NONE;
-                    continue;
-                }
+/// Timer callback, hands a deferred client back to the engine.
+static void CALLBACK client_resume_timer(client_t *self, unused BOOLEAN fired) {
+    self->resume_io = (engine_io_t) { .op = ENGINE_OP_RESUME };
+    PostQueuedCompletionStatus(server.engine.port, 0, (ULONG_PTR)self, &self->resume_io.overlapped);
+}
 
-                cc = INTERMEDIATE_VARIABLE;
-                len++;
+void client_on_resume(client_t *self) {
+    DeleteTimerQueueTimer(nullptr, self->resume_timer, nullptr);
+    self->resume_timer = nullptr;
+    self->deferred = false;
 
-                // Name
-                int olen = len;
-                while (true) {
-                    if (recv(self->socket, buffer + len, sizeof(char), 0) == SOCKET_ERROR) {
-                        mutex_release(self->mutex);
-                        client_delete(self);
-                        return 0;
-                    }
-                    if (buffer[len] == '\0' && olen - len >= MAX_INTERMEDIATE_STRING_LENGTH - 1) {
-                        len++;
-                        break;
-                    }
-                    len++;
-                }
+    client_read_frames(self);
+    if (!self->deferred && !client_post_recv(self))
+        client_close(self);
+    client_release(self);
+}
 
-                // Type
-                if (recv(self->socket, buffer + len, sizeof(char), 0) == SOCKET_ERROR) {
-                    mutex_release(self->mutex);
-                    client_delete(self);
-                    return 0;
-                }
-                len++;
-
-                // Value
-                switch ((intermediate_type_e)*(buffer + len - 1)) {
-                    case INTERMEDIATE_STRING:
-                        olen = len;
-                        while (true) {
-                            if (recv(self->socket, buffer + len, sizeof(char), 0) == SOCKET_ERROR) {
-                                mutex_release(self->mutex);
-                                client_delete(self);
-                                return 0;
-                            }
-                            if (buffer[len] == '\0' && olen - len >= MAX_INTERMEDIATE_STRING_LENGTH - 1) {
-                                len++;
-                                break;
-                            }
-                            len++;
-                        }
-                        break;
+/// Take a token for an event from the client's buckets.
+/// Returns how long the event has to wait in milliseconds, 0 if it can be dispatched.
+/// The buckets are shared by the TCP, UDP and reliable paths, so they are taken under the client's mutex.
+static uint64_t client_rate_limit(client_t *self, const char *type, uint64_t now) {
+    uint64_t wait = 0;
+    mutex_lock(self->mutex);
+    if (!ratelimit_take(&self->limit, now)) {
+        wait = max(ratelimit_wait(&self->limit), 1);
+        mutex_release(self->mutex);
+        return wait;
+    }
 
-                    case INTERMEDIATE_S8:
-                    case INTERMEDIATE_U8:
-                        if (recv(self->socket, buffer + len, sizeof(int8_t), 0) == SOCKET_ERROR) {
-                            mutex_release(self->mutex);
-                            client_delete(self);
-                            return 0;
-                        }
-                        len += sizeof(int8_t);
-                        break;
+    ratelimit_t *limit = server.rate_limits.pair_count ? hashtable_get(&self->limits, (void *)type) : nullptr;
+    if (!limit && server.rate_limits.pair_count) {
+        ratelimit_t *def = hashtable_get(&server.rate_limits, (void *)type);
+        if (def)
+            limit = hashtable_insert(&self->limits, (void *)type, def, sizeof(ratelimit_t));
+    }
 
-                    case INTERMEDIATE_S16:
-                    case INTERMEDIATE_U16:
-                        if (recv(self->socket, buffer + len, sizeof(int16_t), 0) == SOCKET_ERROR) {
-                            mutex_release(self->mutex);
-                            client_delete(self);
-                            return 0;
-                        }
-                        len += sizeof(int16_t);
-                        break;
+    if (limit && !ratelimit_take(limit, now)) {
+        // Give back the client wide token, this event won't be dispatched yet
+        self->limit.tokens += 1;
+        wait = max(ratelimit_wait(limit), 1);
+    }
+    mutex_release(self->mutex);
+    return wait;
+}
 
-                    case INTERMEDIATE_S32:
-                    case INTERMEDIATE_U32:
-                    case INTERMEDIATE_F32:
-                        if (recv(self->socket, buffer + len, sizeof(int32_t), 0) == SOCKET_ERROR) {
-                            mutex_release(self->mutex);
-                            client_delete(self);
-                            return 0;
-                        }
-                        len += sizeof(int32_t);
-                        break;
+/// Apply a delta acknowledgement, returns false if the frame isn't one.
+static bool client_delta_ack(client_t *self, const intermediate_view_t *view) {
+    if (strcmp(view->type, DELTA_ACK_EVENT) != 0)
+        return false;
 
-                    case INTERMEDIATE_S64:
-                    case INTERMEDIATE_U64:
-                    case INTERMEDIATE_F64:
-                        if (recv(self->socket, buffer + len, sizeof(int64_t), 0) == SOCKET_ERROR) {
-                            mutex_release(self->mutex);
-                            client_delete(self);
-                            return 0;
-                        }
-                        len += sizeof(int64_t);
-                        break;
+    // The baseline may come in any integer encoding a client picked for it
+    intermediate_view_var_t event, baseline;
+    double number;
+    if (!intermediate_view_find(view, "event", &event) || event.type != INTERMEDIATE_STRING
+        || !intermediate_view_find(view, "baseline", &baseline) || !intermediate_read_number(baseline.type, baseline.value, &number)
+        || number < 0 || number > UINT32_MAX)
+        return true;
+    uint32_t id = number;
+
+    mutex_lock(self->mutex);
+    delta_t *delta = hashtable_get(&self->deltas, (void *)event.value);
+    if (delta)
+        delta_ack(delta, id);
+    mutex_release(self->mutex);
+
+    return true;
+}
+
+/// Hand a validated frame to the scripting api, unless it is a delta or symbols acknowledgement.
+static void client_dispatch_view(client_t *self, const intermediate_view_t *view) {
+    if (strcmp(view->type, CLIENT_SYMBOLS_ACK_EVENT) == 0) {
+        self->compact = true;
+        return;
+    }
+
+    result_t res;
+    if (!client_delta_ack(self, view) && !(res = scripting_api_try_event_view(self->scripts, view, self->uuid)).is_ok) {
+        console_error(res.description);
+        result_discard(res);
+    }
+}
+
+/// Count an event that went over the client's rate limit.
+/// Clients choose the type, so only those in net.config.rate_limits are counted by name.
+static void client_count_limited(client_t *self, const char *type) {
+    self->rate_limited++;
+    InterlockedIncrement64(&server.stats.rate_limited);
+    bool known = server.rate_limits.pair_count && hashtable_get(&server.rate_limits, (void *)type);
+    stats_count(&server.stats.rate_limited_events, known ? type : STATS_OTHER_EVENTS, 1);
+}
+
+/// Hand a frame to the scripting api unless it is over the client's rate limit.
+/// Datagrams and bundles can't wait, so frames over it are dropped.
+static void client_dispatch_limited(client_t *self, const intermediate_view_t *view) {
+    if (client_rate_limit(self, view->type, GetTickCount64())) {
+        client_count_limited(self, view->type);
+        return;
+    }
+    client_dispatch_view(self, view);
+}
+
+/// Validate a bundle and every frame in it, handing each to the scripting api in turn.
+/// Frames are taken from the rate limit if limited is set, a bundle can't wait part way so those over it are dropped.
+static void client_dispatch_bundle(client_t *self, const char *frame, int len, bool limited) {
+    result_t res;
+    intermediate_bundle_t bundle;
+    if (!(res = intermediate_bundle_from_buffer(frame, len, &bundle)).is_ok) {
+        console_error(res.description);
+        result_discard(res);
+        return;
+    }
+
+    const char *cursor = bundle.frames, *inner;
+    int inner_len;
+    while (intermediate_bundle_next(&bundle, &cursor, &inner, &inner_len)) {
+        intermediate_view_t view;
+        if (!(res = intermediate_view_from_buffer(inner, inner_len, &view)).is_ok) {
+            console_error(res.description);
+            result_discard(res);
+            continue;
+        }
+        if (limited)
+            client_dispatch_limited(self, &view);
+        else
+            client_dispatch_view(self, &view);
+    }
+}
+
+/// Validate a complete frame and hand it to the scripting api, reading it in place.
+/// Frames are taken from the rate limit if limited is set, callers that already took a token for them leave it unset.
+static void client_dispatch(client_t *self, char *frame, int len, bool limited) {
+    if ((intermediate_control_e)*frame == INTERMEDIATE_BUNDLE) {
+        client_dispatch_bundle(self, frame, len, limited);
+        return;
+    }
+
+    result_t res;
+    intermediate_view_t view;
+    if (!(res = intermediate_view_from_buffer(frame, len, &view)).is_ok) {
+        console_error(res.description);
+        result_discard(res);
+        return;
+    }
+    if (limited)
+        client_dispatch_limited(self, &view);
+    else
+        client_dispatch_view(self, &view);
+}
+
+/// Find the first byte that could start a frame or a bundle, returns nullptr if there is none.
+/// Bundles are looked for only up to the first header, so one isn't entered through a frame inside it.
+static char *client_resync(char *buffer, uint64_t len) {
+    char *header = memchr(buffer, INTERMEDIATE_HEADER, len);
+    char *bundle = memchr(buffer, INTERMEDIATE_BUNDLE, header ? (uint64_t)(header - buffer) : len);
+    return bundle ? bundle : header;
+}
+
+void client_read_frames(client_t *self) {
+    ring_t *ring = &self->recv_ring;
+    while (ring_size(ring) && self->state < CLIENT_STATE_DRAINING) {
+        uint64_t len;
+        char *frame = ring_read_span(ring, &len);
+
+        // Frames that wrap around the end of the ring are copied out first
+        if (len < ring_size(ring) && len < MAX_INTERMEDIATE_SIZE) {
+            len = ring_peek(ring, self->frame, MAX_INTERMEDIATE_SIZE);
+            frame = self->frame;
+        }
+
+        int size = intermediate_frame_length(frame, len);
+        if (size == 0)
+            break;
+
+        if (size < 0) {
+            // Skip ahead to the next thing that looks like the start of a frame
+            char *next = client_resync(frame + 1, len - 1);
+            ring_consume(ring, next ? (uint64_t)(next - frame) : len);
+            continue;
+        }
+
+        // Unverified clients can't send events
+        if (!self->account) {
+            ring_consume(ring, size);
+            continue;
+        }
+
+        // Bundles are limited per frame once they have been validated
+        if ((intermediate_control_e)*frame == INTERMEDIATE_BUNDLE) {
+            client_dispatch_bundle(self, frame, size, true);
+            ring_consume(ring, size);
+            continue;
+        }
+
+        const char *type = frame + INTERMEDIATE_TYPE_OFFSET;
+        uint64_t wait = client_rate_limit(self, type, GetTickCount64());
+        if (wait) {
+            client_count_limited(self, type);
+
+            // Leave the frame in the ring and stop reading until a token is available
+            if (server.rate_policy == RATE_POLICY_DEFER) {
+                client_retain(self);
+                if (CreateTimerQueueTimer(&self->resume_timer, nullptr, (WAITORTIMERCALLBACK)client_resume_timer, self, wait, 0, WT_EXECUTEONLYONCE)) {
+                    self->deferred = true;
+                    break;
                 }
-                break;
+                client_release(self);
             }
-            case INTERMEDIATE_END: {
-                len++;
-
-                result_t res;
-                intermediate_t *intermediate = nullptr;
-                if (!(res = intermediate_from_buffer(buffer, len, &intermediate)).is_ok) {
-                    console_error(res.description);
-                    result_discard(res);
-
-                    memset(buffer, 0, MAX_INTERMEDIATE_SIZE);
-                    cc = INTERMEDIATE_NONE;
-                    len = 0;
-                    mutex_release(self->mutex);
-                    Sleep(33);
-                    continue;
-                }
 
-                // Process
-                if (!(res = scripting_api_try_event(&server.api, intermediate, self->uuid)).is_ok) {
-                    console_error(res.description);
-                    result_discard(res);
-                }
-                intermediate_delete(intermediate);
+            ring_consume(ring, size);
+            continue;
+        }
+
+        client_dispatch(self, frame, size, false);
+        ring_consume(ring, size);
+    }
+}
+
+bool client_udp_ticket(client_t *self, uint32_t count, uint32_t *ticket) {
+    mutex_lock(self->mutex);
+    bool ok = self->udp_ticket - self->udp_turn + count <= CLIENT_UDP_WINDOW;
+    if (ok) {
+        *ticket = self->udp_ticket;
+        self->udp_ticket += count;
+    }
+    mutex_release(self->mutex);
+    return ok;
+}
+
+void client_udp_dispatch(client_t *self, uint32_t ticket, const intermediate_view_t *view) {
+    // Park a copy of the datagram if an earlier one is still being validated, its worker will dispatch this one too
+    mutex_lock(self->mutex);
+    if (ticket != self->udp_turn) {
+        intermediate_view_t *parked = &self->udp_parked[ticket % CLIENT_UDP_WINDOW];
+        *parked = view ? intermediate_view_copy(view) : (intermediate_view_t) { 0 };
+        self->udp_ready |= 1ull << (ticket % CLIENT_UDP_WINDOW);
+        mutex_release(self->mutex);
+        return;
+    }
+    mutex_release(self->mutex);
+
+    // Events are dispatched without the client's mutex, scripts may send to the client
+    intermediate_view_t parked = { 0 };
+    while (true) {
+        if (view && self->account)
+            client_dispatch_limited(self, view);
+        free((char *)parked.buffer);
+
+        mutex_lock(self->mutex);
+        uint32_t next = ++self->udp_turn % CLIENT_UDP_WINDOW;
+        bool ready = self->udp_ready & (1ull << next);
+        parked = self->udp_parked[next];
+        self->udp_ready &= ~(1ull << next);
+        mutex_release(self->mutex);
 
-                memset(buffer, 0, MAX_INTERMEDIATE_SIZE);
-                cc = INTERMEDIATE_NONE;
-                len = 0;
+        if (!ready)
+            break;
+        view = parked.buffer ? &parked : nullptr;
+    }
+}
 
-                mutex_release(self->mutex);
-                Sleep(33);
-                continue;
+/// Tickets a datagram's frame needs, one per frame of a bundle.
+/// Malformed bundles take one, which is given up once validation fails.
+static uint32_t client_udp_tickets(const char *frame, int len) {
+    if (len < (int)INTERMEDIATE_BUNDLE_HEADER_SIZE || (intermediate_control_e)*frame != INTERMEDIATE_BUNDLE)
+        return 1;
+    uint8_t count = frame[sizeof(char) + sizeof(uint16_t)];
+    return count && count <= INTERMEDIATE_MAX_BUNDLE ? count : 1;
+}
+
+/// Validate a datagram's frame and dispatch it with the tickets taken for it.
+/// Tickets a malformed frame leaves unused only give up their turn.
+static void client_udp_frames(client_t *self, uint32_t ticket, uint32_t count, const char *frame, int len) {
+    result_t res;
+    intermediate_view_t view;
+    uint32_t used = 0;
+
+    if ((intermediate_control_e)*frame != INTERMEDIATE_BUNDLE) {
+        if (!(res = intermediate_view_from_buffer(frame, len, &view)).is_ok) {
+            console_error(res.description);
+            result_discard(res);
+        }
+        client_udp_dispatch(self, ticket + used++, res.is_ok ? &view : nullptr);
+    } else {
+        intermediate_bundle_t bundle;
+        const char *cursor, *inner;
+        int inner_len;
+        if (!(res = intermediate_bundle_from_buffer(frame, len, &bundle)).is_ok) {
+            console_error(res.description);
+            result_discard(res);
+        }
+        for (cursor = bundle.frames; res.is_ok && used < count && intermediate_bundle_next(&bundle, &cursor, &inner, &inner_len);) {
+            result_t frame_res;
+            if (!(frame_res = intermediate_view_from_buffer(inner, inner_len, &view)).is_ok) {
+                console_error(frame_res.description);
+                result_discard(frame_res);
             }
-            default: continue;
+            client_udp_dispatch(self, ticket + used++, frame_res.is_ok ? &view : nullptr);
         }
+    }
+
+    while (used < count)
+        client_udp_dispatch(self, ticket + used++, nullptr);
+}
+
+void client_udp_receive(client_t *self, const char *buffer, int len) {
+    // Tickets are taken before decoding so other workers can't overtake this datagram
+    uint32_t ticket, count = client_udp_tickets(buffer, len);
+    if (!client_udp_ticket(self, count, &ticket)) {
+        InterlockedIncrement64(&server.stats.udp_dropped);
+        return;
+    }
+    client_udp_frames(self, ticket, count, buffer, len);
+}
+
+/// Dispatch the buffered frames of the ordered lane that are next in sequence.
+/// Only one worker delivers at a time, frames arriving meanwhile are left to it.
+static void client_deliver_ordered(client_t *self) {
+    mutex_lock(self->mutex);
+    reliable_lane_t *lane = &self->reliable->lanes[RELIABLE_ORDERED];
+    if (lane->delivering) {
+        mutex_release(self->mutex);
+        return;
+    }
+    lane->delivering = true;
+    mutex_release(self->mutex);
+
+    while (true) {
+        uint16_t len;
+        mutex_lock(self->mutex);
+        char *frame = reliable_next(self->reliable, RELIABLE_ORDERED, &len);
+        if (!frame)
+            lane->delivering = false;
+        mutex_release(self->mutex);
 
+        if (!frame)
+            break;
+        client_dispatch(self, frame, len, true);
+        free(frame);
+    }
+}
+
+void client_on_reliable(client_t *self, const char *buffer, int len) {
+    bool ack = (intermediate_control_e)*buffer == INTERMEDIATE_ACK;
+    if ((ack ? len < (int)RELIABLE_ACK_SIZE : len <= (int)RELIABLE_HEADER_SIZE) || (uint8_t)buffer[1] >= RELIABLE_LANES)
+        return;
+
+    reliable_lane_e lane = (reliable_lane_e)buffer[1];
+    uint16_t sequence;
+    memcpy(&sequence, buffer + sizeof(char) * 2, sizeof(uint16_t));
+
+    if (ack) {
+        uint32_t bits;
+        memcpy(&bits, buffer + sizeof(char) * 2 + sizeof(uint16_t), sizeof(uint32_t));
+        mutex_lock(self->mutex);
+        if (self->reliable)
+            reliable_on_ack(self->reliable, lane, sequence, bits, GetTickCount64());
         mutex_release(self->mutex);
+        return;
+    }
+
+    const char *frame = buffer + RELIABLE_HEADER_SIZE;
+    uint16_t frame_len = len - RELIABLE_HEADER_SIZE;
+    char reply[RELIABLE_ACK_SIZE];
+
+    // Unordered frames keep their place among the client's other datagrams
+    uint32_t ticket, count = client_udp_tickets(frame, frame_len);
+    if (lane == RELIABLE_UNORDERED && !client_udp_ticket(self, count, &ticket)) {
+        InterlockedIncrement64(&server.stats.udp_dropped);
+        return;
+    }
+
+    mutex_lock(self->mutex);
+    if (!self->reliable)
+        self->reliable = reliable_new();
+    int received = reliable_receive(self->reliable, lane, sequence, frame, frame_len);
+    if (received >= 0)
+        reliable_ack(self->reliable, lane, sequence, reply);
+    mutex_release(self->mutex);
+
+    // Duplicates are acknowledged again in case the earlier acknowledgement was lost
+    if (received >= 0)
+        udp_send(&server.udp, &self->address, packet_raw(reply, sizeof(reply)));
+
+    if (lane == RELIABLE_ORDERED) {
+        if (received > 0)
+            client_deliver_ordered(self);
+        return;
+    }
+
+    if (received > 0) {
+        client_udp_frames(self, ticket, count, frame, frame_len);
+        return;
+    }
+    for (uint32_t i = 0; i < count; ++i)
+        client_udp_dispatch(self, ticket + i, nullptr);
+}
+
+void client_resend_reliable(client_t *self, uint64_t now) {
+    packet_t *due[CLIENT_SEND_BATCH];
+    mutex_lock(self->mutex);
+    int count = self->reliable ? reliable_due(self->reliable, now, due, CLIENT_SEND_BATCH) : 0;
+    mutex_release(self->mutex);
+
+    if (count < 0) {
+        console_log("Client '%s' stopped acknowledging reliable packets.", self->uuid);
+        client_close(self);
+        return;
+    }
+
+    for (int i = 0; i < count; ++i)
+        udp_send(&server.udp, &self->address, due[i]);
+    InterlockedAdd64(&server.stats.reliable_retransmitted, count);
+}
+
+void client_close(client_t *self) {
+    if (InterlockedExchange(&self->state, CLIENT_STATE_CLOSING) == CLIENT_STATE_CLOSING)
+        return;
+
+    // Disconnect Event
+    if (self->account) {
+        result_t res;
+        intermediate_t *intermediate = intermediate_new("disconnect", 0);
+        if (!(res = scripting_api_try_event(self->scripts, intermediate, self->uuid)).is_ok) {
+            console_error(res.description);
+            result_discard(res);
+        }
+        intermediate_delete(intermediate);
+
+        scripting_api_delete_client(self->scripts, self->uuid);
     }
+    self->account = 0;
 
-    return 0;
+    registry_remove(&server.clients, self->handle);
+    grid_remove(&server.grid, self);
+
+    // Pending operations complete with an error and drop their references
+    closesocket(self->socket);
+
+    client_release(self);
 }
 
 void client_kick(client_t *self, const char *reason) {
@@ -283,45 +641,311 @@ void client_kick(client_t *self, const char *reason) {
     // Goodbye
     intermediate_t *intermediate = intermediate_new("kick", 0);
     intermediate_add_var(intermediate, "reason", INTERMEDIATE_STRING, (void *)reason, strlen(reason) + 1);
+    result_discard(client_send_intermediate(self, intermediate));
+    intermediate_delete(intermediate);
+
+    // Close once the kick has been written
+    mutex_lock(self->mutex);
+    bool drained = !self->queue_count && !self->sending_count;
+    InterlockedCompareExchange(&self->state, CLIENT_STATE_DRAINING, CLIENT_STATE_CONNECTING);
+    InterlockedCompareExchange(&self->state, CLIENT_STATE_DRAINING, CLIENT_STATE_CONNECTED);
+    mutex_release(self->mutex);
+
+    if (drained)
+        client_close(self);
+}
+
+/// Send every symbol, split over as many intermediates as it takes to keep each one within a frame, then every schema.
+static void client_send_symbols(client_t *self) {
+    intermediate_t *intermediate = nullptr;
+    int size = 0;
+    for (uint32_t i = 0; i < intermediate_symbols.count; ++i) {
+        const char *name = intermediate_symbols.names[i];
+        int var_size = sizeof(char) * 2 + strlen(name) + 1 + sizeof(uint16_t);
+        if (intermediate && size + var_size >= MAX_INTERMEDIATE_SIZE) {
+            client_send_packet(self, packet_new(intermediate_to_scratch(intermediate, false, &size), size));
+            intermediate_delete(intermediate);
+            intermediate = nullptr;
+        }
+        if (!intermediate) {
+            intermediate = intermediate_new(CLIENT_SYMBOLS_EVENT, 0);
+            size = INTERMEDIATE_TYPE_OFFSET + sizeof(CLIENT_SYMBOLS_EVENT) + sizeof(char);
+        }
 
-    int len = 0;
-    char *buffer = intermediate_to_buffer(intermediate, &len);
-    free(intermediate);
+        // Names are sent as text here, they are what the client learns
+        uint16_t symbol = i;
+        intermediate_add_var(intermediate, (char *)name, INTERMEDIATE_U16, &symbol, sizeof(uint16_t));
+        size += var_size;
+    }
 
-    send(self->socket, buffer, len, 0);
-    free(buffer);
-    Sleep(100);
-    client_delete(self);
+    if (intermediate) {
+        client_send_packet(self, packet_new(intermediate_to_scratch(intermediate, false, &size), size));
+        intermediate_delete(intermediate);
+    }
+
+    for (uint32_t i = 0; i < schemas.count; ++i) {
+        intermediate = schema_describe(schemas.list[i]);
+        client_send_packet(self, packet_new(intermediate_to_scratch(intermediate, false, &size), size));
+        intermediate_delete(intermediate);
+    }
 }
 
 void client_verify(client_t *self, discord_id_t account, const char *username) {
     if (account && !self->account) {
         // Create Client
-        scripting_api_create_client(&server.api, self->uuid, self->address, account, username);
+        scripting_api_create_client(self->scripts, self->uuid, self->handle, self->address, account, username);
 
         // Connect Event
         result_t res;
         intermediate_t *intermediate = intermediate_new("connect", 0);
-        if (!(res = scripting_api_try_event(&server.api, intermediate, self->uuid)).is_ok) {
+        if (!(res = scripting_api_try_event(self->scripts, intermediate, self->uuid)).is_ok) {
             console_error(res.description);
             result_discard(res);
         }
         intermediate_delete(intermediate);
 
         self->account = account;
+        InterlockedCompareExchange(&self->state, CLIENT_STATE_CONNECTED, CLIENT_STATE_CONNECTING);
+        client_send_symbols(self);
     }
 }
 
-result_t client_send_intermediate(client_t *self, intermediate_t *intermediate) {
-    int len = 0;
-    char *buffer = intermediate_to_buffer(intermediate, &len);
+/// Replace every run of consecutive packets that fits in one bundle with the bundle, taking ownership of the packets.
+/// Returns how many packets are left.
+static uint32_t client_bundle(packet_t **packets, uint32_t count) {
+    uint32_t left = 0;
+    for (uint32_t i = 0; i < count;) {
+        uint32_t run = 0, len = INTERMEDIATE_BUNDLE_HEADER_SIZE;
+        while (i + run < count && run < INTERMEDIATE_MAX_BUNDLE && len + sizeof(uint16_t) + packets[i + run]->len <= MAX_INTERMEDIATE_SIZE)
+            len += sizeof(uint16_t) + packets[i + run++]->len;
+
+        if (run < 2) {
+            packets[left++] = packets[i++];
+            continue;
+        }
+
+        // Bundles are written to slots already read, never past i
+        packet_t *bundle = packet_bundle(packets + i, run);
+        for (uint32_t j = 0; j < run; ++j)
+            packet_release(packets[i + j]);
+        packets[left++] = bundle;
+        i += run;
+
+        InterlockedIncrement64(&server.stats.bundles);
+        InterlockedAdd64(&server.stats.bundled, run);
+    }
+    return left;
+}
+
+/// Post a send for as many queued packets as fit in one batch.
+/// Must be called with the client's mutex held, returns false if the send failed.
+static bool client_flush(client_t *self) {
+    if (self->sending_count || !self->queue_count || self->state == CLIENT_STATE_CLOSING)
+        return true;
+
+    uint32_t count = min(self->queue_count, CLIENT_SEND_BATCH);
+    for (uint32_t i = 0; i < count; ++i)
+        self->sending[i] = self->queue[(self->queue_head + i) % server.send_queue];
+    self->queue_head = (self->queue_head + count) % server.send_queue;
+    self->queue_count -= count;
+
+    if (self->compact)
+        count = client_bundle(self->sending, count);
+    for (uint32_t i = 0; i < count; ++i)
+        self->send_buffers[i] = (WSABUF) { .len = self->sending[i]->len, .buf = self->sending[i]->data };
+    self->sending_count = count;
+
+    self->send_io = (engine_io_t) { .op = ENGINE_OP_SEND };
+
+    client_retain(self);
+    if (WSASend(self->socket, self->send_buffers, count, nullptr, 0, &self->send_io.overlapped, nullptr) == SOCKET_ERROR
+        && WSAGetLastError() != WSA_IO_PENDING) {
+        for (uint32_t i = 0; i < count; ++i)
+            packet_release(self->sending[i]);
+        self->sending_count = 0;
+        client_release(self);
+        return false;
+    }
+
+    return true;
+}
+
+void client_on_send(client_t *self, unused DWORD bytes, bool ok) {
+    mutex_lock(self->mutex);
+    for (uint32_t i = 0; i < self->sending_count; ++i)
+        packet_release(self->sending[i]);
+    self->sending_count = 0;
+
+    bool failed = !ok || !client_flush(self);
+    bool drained = self->state == CLIENT_STATE_DRAINING && !self->queue_count && !self->sending_count;
+    mutex_release(self->mutex);
+
+    if (drained)
+        shutdown(self->socket, SD_SEND);
+    if (failed || drained)
+        client_close(self);
+    client_release(self);
+}
+
+/// Send every held datagram, bundling as many as fit together.
+static void client_flush_udp(client_t *self) {
+    packet_t *packets[CLIENT_SEND_BATCH];
+    mutex_lock(self->mutex);
+    uint32_t count = self->udp_queued;
+    memcpy(packets, self->udp_queue, count * sizeof(packet_t *));
+    self->udp_queued = 0;
+    mutex_release(self->mutex);
+
+    count = client_bundle(packets, count);
+    for (uint32_t i = 0; i < count; ++i)
+        udp_send(&server.udp, &self->address, packets[i]);
+}
+
+void client_flush_queue(client_t *self) {
+    mutex_lock(self->mutex);
+    bool failed = !client_flush(self);
+    mutex_release(self->mutex);
+
+    if (failed)
+        client_close(self);
+    client_flush_udp(self);
+}
+
+/// Swap a packet for its symbol coded encoding if the client accepted the symbols, taking ownership of it.
+static packet_t *client_encoding(client_t *self, packet_t *packet) {
+    if (!self->compact || !packet->symbolic)
+        return packet;
+
+    packet_t *symbolic = packet_retain(packet->symbolic);
+    packet_release(packet);
+    return symbolic;
+}
+
+void client_send_packet(client_t *self, packet_t *packet) {
+    bool disconnect = false;
+    packet = client_encoding(self, packet);
 
     mutex_lock(self->mutex);
-    if (send(self->socket, buffer, len, 0) == SOCKET_ERROR) {
+    if (self->state >= CLIENT_STATE_DRAINING) {
         mutex_release(self->mutex);
-        return result_error("Failed to send intermediate '%s'.", intermediate->type);
+        packet_release(packet);
+        return;
+    }
+
+    if (self->queue_count < server.send_queue) {
+        self->queue[(self->queue_head + self->queue_count++) % server.send_queue] = packet;
+    } else {
+        switch (server.slow_policy) {
+            case SLOW_POLICY_CONFLATE: {
+                // Replace the oldest queued packet of the same type
+                const char *type = packet_type(packet);
+                for (uint32_t i = 0; i < self->queue_count; ++i) {
+                    packet_t **queued = &self->queue[(self->queue_head + i) % server.send_queue];
+                    if (bstrcmp(packet_type(*queued), type)) {
+                        packet_release(*queued);
+                        *queued = packet;
+                        packet = nullptr;
+                        InterlockedIncrement64(&server.stats.send_conflated);
+                        break;
+                    }
+                }
+                if (!packet)
+                    break;
+                [[fallthrough]];
+            }
+            case SLOW_POLICY_DROP:
+                packet_release(packet);
+                InterlockedIncrement64(&server.stats.send_dropped);
+                break;
+
+            case SLOW_POLICY_DISCONNECT:
+                packet_release(packet);
+                disconnect = true;
+                break;
+        }
     }
+
+    // Ticking servers write the queue once per tick instead
+    bool failed = !server.tick_rate && !client_flush(self);
     mutex_release(self->mutex);
 
+    if (disconnect) {
+        console_log("Client '%s' was disconnected for not keeping up.", self->uuid);
+        InterlockedIncrement64(&server.stats.slow_disconnects);
+    }
+    if (failed || disconnect)
+        client_close(self);
+}
+
+void client_send_udp(client_t *self, packet_t *packet) {
+    packet = client_encoding(self, packet);
+    if (!server.tick_rate || !self->compact) {
+        udp_send(&server.udp, &self->address, packet);
+        return;
+    }
+
+    // Too much for one tick sends what is held early
+    while (true) {
+        mutex_lock(self->mutex);
+        bool full = self->udp_queued == CLIENT_SEND_BATCH;
+        if (!full)
+            self->udp_queue[self->udp_queued++] = packet;
+        mutex_release(self->mutex);
+
+        if (!full)
+            return;
+        client_flush_udp(self);
+    }
+}
+
+result_t client_send_intermediate(client_t *self, intermediate_t *intermediate) {
+    if (self->state >= CLIENT_STATE_DRAINING)
+        return result_error("Failed to send intermediate '%s', client is disconnecting.", intermediate->type);
+
+    client_send_packet(self, packet_from_intermediate(intermediate));
     return result_ok();
-}
\ No newline at end of file
+}
+
+void client_send_reliable(client_t *self, packet_t *packet, bool ordered) {
+    if (self->state >= CLIENT_STATE_DRAINING) {
+        packet_release(packet);
+        return;
+    }
+
+    packet = client_encoding(self, packet);
+    mutex_lock(self->mutex);
+    if (!self->reliable)
+        self->reliable = reliable_new();
+    packet_t *wrapped = reliable_send(self->reliable, ordered ? RELIABLE_ORDERED : RELIABLE_UNORDERED, packet, GetTickCount64());
+    mutex_release(self->mutex);
+    packet_release(packet);
+
+    // A full window means the client has stopped acknowledging, treat it like a full queue
+    if (!wrapped) {
+        InterlockedIncrement64(&server.stats.slow_disconnects);
+        client_close(self);
+        return;
+    }
+
+    InterlockedIncrement64(&server.stats.reliable_sent);
+    udp_send(&server.udp, &self->address, wrapped);
+}
+
+void client_send_delta(client_t *self, intermediate_t *state, bool udp) {
+    mutex_lock(self->mutex);
+    delta_t *delta = hashtable_get(&self->deltas, state->type);
+    if (!delta)
+        delta = hashtable_insert(&self->deltas, state->type, &(delta_t) { 0 }, sizeof(delta_t));
+
+    int saved = 0;
+    packet_t *packet = delta_encode(delta, state, self->compact, &saved);
+    mutex_release(self->mutex);
+
+    InterlockedIncrement64(&server.stats.delta_packets);
+    InterlockedAdd64(&server.stats.delta_saved, saved);
+
+    if (udp)
+        client_send_udp(self, packet);
+    else
+        client_send_packet(self, packet);
+}
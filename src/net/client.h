@@ -1,7 +1,16 @@
 #pragma once
 #include "../data/mutex.h"
+#include "../data/ring.h"
+#include "../data/ratelimit.h"
+#include "../data/hashtable.h"
 #include "../api/intermediate.h"
+#include "../api/scripting_api.h"
 #include "discord.h"
+#include "engine.h"
+#include "packet.h"
+#include "delta.h"
+#include "reliable.h"
+#include "registry.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <winsock2.h>
@@ -9,23 +18,160 @@
 #define UUID_LENGTH 16
 #define UUID_CHARACTERS "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"
 
+/// Size of the per-client receive ring, must be a power of two.
+#define CLIENT_RING_SIZE 16384
+/// Maximum amount of packets written by a single send.
+#define CLIENT_SEND_BATCH 64
+/// Maximum amount of a client's datagrams between receive and dispatch, at most 64.
+#define CLIENT_UDP_WINDOW 64
+
+/// Event type listing every symbol, sent once a client is verified with each name as a u16 variable.
+#define CLIENT_SYMBOLS_EVENT "symbols"
+/// Event type clients send once they can read symbol coded variables, schema frames and bundles.
+#define CLIENT_SYMBOLS_ACK_EVENT "symbols_ack"
+
+typedef enum client_state_e {
+    CLIENT_STATE_CONNECTING,
+    CLIENT_STATE_CONNECTED,
+    CLIENT_STATE_DRAINING,
+    CLIENT_STATE_CLOSING,
+} client_state_e;
+
 typedef struct client_t {
     char *uuid;
+    client_handle_t handle;
     discord_id_t account;
     mutex_t mutex;
+    volatile LONG references;
+    volatile LONG state;
+    // Scripting shard the client's events run on
+    scripting_api_t *scripts;
 
     SOCKET socket;
     struct sockaddr_in address;
-    HANDLE thread;
+
+    // Pending receive
+    engine_io_t recv_io;
+    WSABUF recv_buffers[2];
+    ring_t recv_ring;
+
+    // Frame reader
+    char *frame;
+
+    // Rate limiting, per event type buckets are created on first use
+    ratelimit_t limit;
+    hashtable_t limits;
+    bool deferred;
+    HANDLE resume_timer;
+    engine_io_t resume_io;
+    uint64_t rate_limited;
+
+    // Outbound queue, flushed by one pending send at a time
+    packet_t **queue;
+    uint32_t queue_head, queue_count;
+    engine_io_t send_io;
+    WSABUF send_buffers[CLIENT_SEND_BATCH];
+    packet_t *sending[CLIENT_SEND_BATCH];
+    uint32_t sending_count;
+
+    // Datagram ordering, tickets are taken on receive and dispatched in turn
+    uint32_t udp_ticket, udp_turn;
+    uint64_t udp_ready;
+    intermediate_view_t udp_parked[CLIENT_UDP_WINDOW];
+
+    // Datagrams held until the end of the tick to be sent bundled, guarded by the client's mutex
+    packet_t *udp_queue[CLIENT_SEND_BATCH];
+    uint32_t udp_queued;
+
+    // Delta state per event type, see delta_t
+    hashtable_t deltas;
+
+    // Reliable UDP lanes, created on first use and guarded by the client's mutex
+    reliable_t *reliable;
+
+    // Accepted the symbol table, so symbol coded names, schema frames and bundles are sent
+    bool compact;
+
+    // Position in the interest grid, guarded by the grid
+    bool gridded;
+    float grid_x, grid_y;
 } client_t;
 
+/// Create a client for an accepted socket and start receiving on it.
 client_t *client_new(SOCKET socket, struct sockaddr_in address);
+/// Free a client, only called once the last reference is released.
 void client_delete(client_t *self);
 
+/// Take a reference to a client.
+void client_retain(client_t *self);
+/// Drop a reference to a client, deleting it when none remain.
+void client_release(client_t *self);
+/// Look up a connected client by handle, stale handles return nullptr.
+/// Returns a retained client which must be released, or nullptr.
+client_t *client_get(client_handle_t handle);
+/// Look up a connected client by uuid.
+/// Returns a retained client which must be released, or nullptr.
+client_t *client_find(const char *uuid);
+/// Look up a connected client by the address it connected from.
+/// Returns a retained client which must be released, or nullptr.
+client_t *client_find_address(struct sockaddr_in address);
+
+/// Take a retained copy of every connected client.
+/// The array must be released with client_snapshot_release.
+client_t **client_snapshot(uint32_t *count);
+/// Release every client in a snapshot and free it.
+void client_snapshot_release(client_t **clients, uint32_t count);
+
 char *client_generate_uuid(void);
-DWORD WINAPI client_handle(client_t *self);
 
-void client_kick(client_t *self, const char *reason);
+/// Post an overlapped receive for the client.
+bool client_post_recv(client_t *self);
+/// Called by the engine once a receive has completed.
+void client_on_recv(client_t *self, DWORD bytes, bool ok);
+/// Called by the engine once a deferred client may read again.
+void client_on_resume(client_t *self);
+/// Dispatch every complete intermediate waiting in the receive ring.
+/// Stops early and schedules a resume if the client is deferred by its rate limit.
+void client_read_frames(client_t *self);
+
+/// Take count consecutive tickets for the frames of a received datagram, fixing their place in the client's event order.
+/// Returns false if too many of the client's datagrams are already waiting.
+bool client_udp_ticket(client_t *self, uint32_t count, uint32_t *ticket);
+/// Dispatch a validated datagram once every earlier ticket has been.
+/// The datagram is copied if it has to wait, a nullptr view only gives up the ticket's turn.
+void client_udp_dispatch(client_t *self, uint32_t ticket, const intermediate_view_t *view);
+/// Take tickets for a datagram, one per frame if it is a bundle, then validate and dispatch its frames in turn.
+void client_udp_receive(client_t *self, const char *buffer, int len);
+
+/// Handle a reliable datagram or an acknowledgement from the client.
+/// New reliable frames are acknowledged and dispatched, in sequence for the ordered lane.
+void client_on_reliable(client_t *self, const char *buffer, int len);
+/// Retransmit every reliable packet whose timeout has passed.
+/// Closes the client if a packet ran out of retries.
+void client_resend_reliable(client_t *self, uint64_t now);
+
+/// Called by the engine once a send has completed.
+void client_on_send(client_t *self, DWORD bytes, bool ok);
+/// Write everything queued for the client and send its held datagrams, called once per tick.
+/// Several packets are sent as bundles to clients that accepted them.
+void client_flush_queue(client_t *self);
+/// Queue a packet to be sent, taking ownership of one reference to it.
+/// Applies the server's slow consumer policy if the queue is full.
+/// The queue is written right away unless the server is ticking.
+void client_send_packet(client_t *self, packet_t *packet);
+/// Send a packet over UDP, taking ownership of one reference to it.
+/// Ticking servers hold it until the end of the tick if the client accepts bundles.
+void client_send_udp(client_t *self, packet_t *packet);
 result_t client_send_intermediate(client_t *self, intermediate_t *intermediate);
+/// Send a packet over UDP until the client acknowledges it, taking ownership of one reference to it.
+/// Disconnects the client if too many of its reliable packets are unacknowledged.
+void client_send_reliable(client_t *self, packet_t *packet, bool ordered);
+/// Send a state intermediate encoded against the latest state of its type the client acknowledged.
+void client_send_delta(client_t *self, intermediate_t *state, bool udp);
+
+/// Disconnect a client and remove it from the server.
+void client_close(client_t *self);
+/// Send a kick intermediate and disconnect once it has been written.
+void client_kick(client_t *self, const char *reason);
 
-void client_verify(client_t *self, discord_id_t account, const char *username);
\ No newline at end of file
+void client_verify(client_t *self, discord_id_t account, const char *username);
@@ -0,0 +1,79 @@
+#include "compress.h"
+#include "server.h"
+#include "../api/intermediate.h"
+#include "../io/fs.h"
+#include <stdlib.h>
+#include <string.h>
+
+result_t compressor_init(compressor_t *self, int level, uint32_t threshold, const char *path) {
+    *self = (compressor_t) {
+        .level = level,
+        .threshold = threshold,
+    };
+    if (!level || !path || !*path)
+        return result_ok();
+
+    char *dictionary;
+    fs_size_t size;
+    result_t res;
+    if (!(res = fs_load(path, &dictionary, &size)).is_ok)
+        return res;
+
+    self->dictionary = ZSTD_createCDict(dictionary, size, level);
+    free(dictionary);
+    if (!self->dictionary)
+        return result_error("Failed to load compression dictionary '%s'.", path);
+
+    return result_ok();
+}
+
+void compressor_cleanup(compressor_t *self) {
+    if (self->dictionary)
+        ZSTD_freeCDict(self->dictionary);
+    *self = (compressor_t) { 0 };
+}
+
+/// Context of the calling thread, created on first use and kept for the thread's lifetime.
+static ZSTD_CCtx *compressor_context(compressor_t *self) {
+    static thread_local ZSTD_CCtx *context = nullptr;
+    if (context)
+        return context;
+
+    // Both lengths are in our own prefix, so the zstd frame doesn't need them
+    context = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(context, ZSTD_c_contentSizeFlag, 0);
+    ZSTD_CCtx_setParameter(context, ZSTD_c_checksumFlag, 0);
+    ZSTD_CCtx_setParameter(context, ZSTD_c_dictIDFlag, 0);
+    if (self->dictionary)
+        ZSTD_CCtx_refCDict(context, self->dictionary);
+    else
+        ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, self->level);
+    return context;
+}
+
+int compressor_compress(compressor_t *self, const char *frame, int len, char *out, int capacity) {
+    if (!self->level || (uint32_t)len < self->threshold || capacity <= (int)COMPRESS_HEADER_SIZE)
+        return 0;
+
+    LARGE_INTEGER start, end;
+    QueryPerformanceCounter(&start);
+    size_t size = ZSTD_compress2(compressor_context(self), out + COMPRESS_HEADER_SIZE, capacity - COMPRESS_HEADER_SIZE, frame, len);
+    QueryPerformanceCounter(&end);
+
+    InterlockedAdd64(&server.stats.compress_time, end.QuadPart - start.QuadPart);
+    InterlockedAdd64(&server.stats.compress_in, len);
+
+    // Not worth it, the raw frame goes out instead
+    if (ZSTD_isError(size) || size + COMPRESS_HEADER_SIZE >= (size_t)len) {
+        InterlockedAdd64(&server.stats.compress_out, len);
+        return 0;
+    }
+
+    out[0] = (char)INTERMEDIATE_COMPRESSED;
+    uint16_t lens[2] = { (uint16_t)size, (uint16_t)len };
+    memcpy(out + sizeof(char), lens, sizeof(lens));
+
+    InterlockedAdd64(&server.stats.compress_out, size + COMPRESS_HEADER_SIZE);
+    InterlockedIncrement64(&server.stats.compressed);
+    return size + COMPRESS_HEADER_SIZE;
+}
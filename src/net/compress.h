@@ -0,0 +1,25 @@
+#pragma once
+#include "../data/result.h"
+#include <stdint.h>
+#include <zstd.h>
+
+/// Frames below this many bytes are sent uncompressed by default.
+#define COMPRESS_DEFAULT_THRESHOLD 128
+/// Size of a compressed frame's prefix, the control byte and the compressed and original lengths.
+#define COMPRESS_HEADER_SIZE (sizeof(char) + sizeof(uint16_t) * 2)
+
+/// Outbound frame compression, optionally against a dictionary trained on captured traffic.
+/// A level of 0 disables compression.
+typedef struct compressor_t {
+    int level;
+    uint32_t threshold;
+    ZSTD_CDict *dictionary;
+} compressor_t;
+
+/// Set up compression, loading the dictionary at path unless it is empty.
+result_t compressor_init(compressor_t *self, int level, uint32_t threshold, const char *path);
+void compressor_cleanup(compressor_t *self);
+
+/// Compress a frame into out, prefixed with INTERMEDIATE_COMPRESSED and both lengths.
+/// Returns the length written, or 0 if the frame should be sent as is.
+int compressor_compress(compressor_t *self, const char *frame, int len, char *out, int capacity);
@@ -0,0 +1,41 @@
+#include "delta.h"
+#include <stdlib.h>
+
+void delta_cleanup(delta_t *self) {
+    if (self->baseline)
+        intermediate_delete(self->baseline);
+    for (uint32_t i = 0; i < DELTA_HISTORY; ++i) {
+        if (self->history[i])
+            intermediate_delete(self->history[i]);
+    }
+    *self = (delta_t) { 0 };
+}
+
+packet_t *delta_encode(delta_t *self, intermediate_t *state, bool symbols, int *saved) {
+    int len = 0;
+    const char *buffer = intermediate_to_delta(state, self->baseline, self->baseline_id, symbols, &len, saved);
+    packet_t *packet = packet_new(buffer, len);
+
+    // Remember what was sent, the oldest state is forgotten
+    intermediate_t **slot = &self->history[self->history_head++ % DELTA_HISTORY];
+    if (*slot)
+        intermediate_delete(*slot);
+    *slot = intermediate_copy(state);
+
+    return packet;
+}
+
+bool delta_ack(delta_t *self, uint32_t id) {
+    for (uint32_t i = 0; i < DELTA_HISTORY; ++i) {
+        if (!self->history[i] || self->history[i]->id != id)
+            continue;
+
+        if (self->baseline)
+            intermediate_delete(self->baseline);
+        self->baseline = self->history[i];
+        self->baseline_id = id;
+        self->history[i] = nullptr;
+        return true;
+    }
+    return false;
+}
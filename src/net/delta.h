@@ -0,0 +1,28 @@
+#pragma once
+#include "../api/intermediate.h"
+#include "packet.h"
+#include <stdint.h>
+
+/// Amount of sent states of one type remembered while waiting for an ack.
+#define DELTA_HISTORY 16
+/// Event type clients send to acknowledge a state, with `event` (string) and `baseline` (any integer type) variables.
+#define DELTA_ACK_EVENT "delta_ack"
+
+/// Delta state of one event type sent to one client.
+/// States are encoded against the latest one the client acknowledged.
+typedef struct delta_t {
+    uint32_t baseline_id;
+    intermediate_t *baseline;
+
+    intermediate_t *history[DELTA_HISTORY];
+    uint32_t history_head;
+} delta_t;
+
+/// Free every state remembered by a delta.
+void delta_cleanup(delta_t *self);
+
+/// Encode a state against the acknowledged baseline and remember it until it is acknowledged.
+/// Names are sent as symbols if symbols is set, saved receives how many bytes were left out compared to a full encoding.
+packet_t *delta_encode(delta_t *self, intermediate_t *state, bool symbols, int *saved);
+/// Make a previously sent state the baseline, returns false if it is no longer remembered.
+bool delta_ack(delta_t *self, uint32_t id);
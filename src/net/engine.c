@@ -0,0 +1,80 @@
+#include "engine.h"
+#include "client.h"
+#include "server.h"
+#include "../io/console.h"
+#include <stdlib.h>
+
+result_t engine_init(engine_t *self, uint32_t workers) {
+    if (!workers) {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        workers = info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+    }
+
+    if (!(self->port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, workers)))
+        return result_error("Failed to create completion port (%lu).", GetLastError());
+
+    self->worker_count = workers;
+    self->workers = calloc(workers, sizeof(HANDLE));
+    for (uint32_t i = 0; i < workers; ++i)
+        self->workers[i] = CreateThread(nullptr, 0, (LPTHREAD_START_ROUTINE)engine_worker, self, 0, nullptr);
+
+    console_log("Started %u network workers.", workers);
+    return result_ok();
+}
+
+void engine_cleanup(engine_t *self) {
+    if (!self->port)
+        return;
+
+    for (uint32_t i = 0; i < self->worker_count; ++i)
+        PostQueuedCompletionStatus(self->port, 0, ENGINE_KEY_SHUTDOWN, nullptr);
+    for (uint32_t i = 0; i < self->worker_count; ++i) {
+        WaitForSingleObject(self->workers[i], INFINITE);
+        CloseHandle(self->workers[i]);
+    }
+
+    free(self->workers);
+    CloseHandle(self->port);
+    *self = (engine_t) { 0 };
+}
+
+result_t engine_attach(engine_t *self, SOCKET socket, void *key) {
+    if (CreateIoCompletionPort((HANDLE)socket, self->port, (ULONG_PTR)key, 0) != self->port)
+        return result_error("Failed to attach socket to completion port (%lu).", GetLastError());
+    return result_ok();
+}
+
+DWORD WINAPI engine_worker(engine_t *self) {
+    while (true) {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED *overlapped = nullptr;
+        bool ok = GetQueuedCompletionStatus(self->port, &bytes, &key, &overlapped, INFINITE);
+
+        // Port closed or shutdown requested
+        if (!overlapped) {
+            if (!ok || key == ENGINE_KEY_SHUTDOWN)
+                break;
+            continue;
+        }
+
+        engine_io_t *io = (engine_io_t *)overlapped;
+        switch (io->op) {
+            case ENGINE_OP_RECV:
+                client_on_recv((client_t *)key, bytes, ok);
+                break;
+            case ENGINE_OP_SEND:
+                client_on_send((client_t *)key, bytes, ok);
+                break;
+            case ENGINE_OP_RESUME:
+                client_on_resume((client_t *)key);
+                break;
+            case ENGINE_OP_TICK:
+                server_on_tick((scripting_api_t *)key);
+                break;
+        }
+    }
+
+    return 0;
+}
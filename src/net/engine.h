@@ -0,0 +1,42 @@
+#pragma once
+#include "../util/win32.h"
+#include "../data/result.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Completion key posted to wake a worker and make it exit.
+#define ENGINE_KEY_SHUTDOWN 0
+
+typedef enum engine_op_e {
+    ENGINE_OP_RECV,
+    ENGINE_OP_SEND,
+    ENGINE_OP_RESUME,
+    // Posted with a scripting shard as the key
+    ENGINE_OP_TICK,
+} engine_op_e;
+
+/// A single overlapped operation, buffers are owned by whoever posts it.
+/// The OVERLAPPED must stay the first member so completions can be cast back.
+typedef struct engine_io_t {
+    OVERLAPPED overlapped;
+    engine_op_e op;
+} engine_io_t;
+
+/// Completion port and the fixed pool of workers draining it.
+typedef struct engine_t {
+    HANDLE port;
+    uint32_t worker_count;
+    HANDLE *workers;
+} engine_t;
+
+/// Create the completion port and start the worker pool.
+/// A worker count of 0 uses one worker per logical processor.
+result_t engine_init(engine_t *self, uint32_t workers);
+/// Stop every worker and close the completion port.
+void engine_cleanup(engine_t *self);
+
+/// Associate a socket with the completion port, completions will carry key.
+result_t engine_attach(engine_t *self, SOCKET socket, void *key);
+
+/// Worker loop, dispatches completions to their owners.
+DWORD WINAPI engine_worker(engine_t *self);
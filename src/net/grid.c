@@ -0,0 +1,167 @@
+#include "grid.h"
+#include "client.h"
+#include "server.h"
+#include <math.h>
+#include <stdlib.h>
+
+/// Cell of a coordinate, clamped to the cells a key can hold since converting past them is undefined.
+static int32_t grid_coordinate(grid_t *self, float value) {
+    double cell = floor((double)value / self->cell_size);
+    if (isnan(cell))
+        return 0;
+    return cell < INT32_MIN ? INT32_MIN : cell > INT32_MAX ? INT32_MAX : (int32_t)cell;
+}
+
+static uint64_t grid_key(int32_t x, int32_t y) {
+    return ((uint64_t)(uint32_t)x << 32) | (uint32_t)y;
+}
+
+/// Remove a client's member from a cell, deleting the cell once it is empty.
+/// Must be called with the grid locked.
+static void grid_cell_remove(grid_t *self, uint64_t key, client_handle_t handle) {
+    grid_cell_t *cell = hashtable_get(&self->cells, &key);
+    if (!cell)
+        return;
+
+    for (uint32_t i = 0; i < cell->count; ++i) {
+        if (cell->members[i].handle == handle) {
+            cell->members[i] = cell->members[--cell->count];
+            break;
+        }
+    }
+
+    if (!cell->count) {
+        free(cell->members);
+        hashtable_remove(&self->cells, &key);
+    }
+}
+
+/// Append the handles of every member of a cell within range.
+static void grid_cell_collect(grid_cell_t *cell, float x, float y, float range, client_handle_t **handles, uint32_t *count, uint32_t *capacity) {
+    for (grid_member_t *member = cell->members; member < cell->members + cell->count; ++member) {
+        float dx = member->x - x, dy = member->y - y;
+        if (dx * dx + dy * dy > range)
+            continue;
+
+        if (*count == *capacity) {
+            *capacity *= 2;
+            *handles = realloc(*handles, *capacity * sizeof(client_handle_t));
+        }
+        (*handles)[(*count)++] = member->handle;
+    }
+}
+
+grid_t grid_new(float cell_size, float radius) {
+    return (grid_t) {
+        .cell_size = cell_size,
+        .radius = radius,
+        .cells = hashtable_arbitrary(sizeof(uint64_t)),
+    };
+}
+
+void grid_delete(grid_t *self) {
+    if (!self->cells.buckets)
+        return;
+
+    uint32_t count = 0;
+    pair_t **pairs = hashtable_pairs(&self->cells, &count);
+    for (pair_t **pl = pairs; pl < pairs + count; ++pl)
+        free(((grid_cell_t *)(*pl)->value)->members);
+    free(pairs);
+
+    hashtable_delete(&self->cells);
+    *self = (grid_t) { 0 };
+}
+
+void grid_move(grid_t *self, client_t *client, float x, float y) {
+    uint64_t key = grid_key(grid_coordinate(self, x), grid_coordinate(self, y));
+
+    mutex_lock(self->cells.mutex);
+    if (client->gridded) {
+        uint64_t old = grid_key(grid_coordinate(self, client->grid_x), grid_coordinate(self, client->grid_y));
+
+        // Staying within the same cell only updates the position
+        grid_cell_t *cell = old == key ? hashtable_get(&self->cells, &key) : nullptr;
+        for (uint32_t i = 0; cell && i < cell->count; ++i) {
+            if (cell->members[i].handle == client->handle) {
+                cell->members[i].x = client->grid_x = x;
+                cell->members[i].y = client->grid_y = y;
+                mutex_release(self->cells.mutex);
+                return;
+            }
+        }
+
+        grid_cell_remove(self, old, client->handle);
+    }
+
+    grid_cell_t *cell = hashtable_get(&self->cells, &key);
+    if (!cell) {
+        grid_cell_t empty = {
+            .members = malloc(GRID_CELL_DEFAULT_SIZE * sizeof(grid_member_t)),
+            .count = 0,
+            .capacity = GRID_CELL_DEFAULT_SIZE,
+        };
+        cell = hashtable_insert(&self->cells, &key, &empty, sizeof(grid_cell_t));
+    }
+
+    if (cell->count == cell->capacity) {
+        cell->capacity *= 2;
+        cell->members = realloc(cell->members, cell->capacity * sizeof(grid_member_t));
+    }
+    cell->members[cell->count++] = (grid_member_t) { .handle = client->handle, .x = x, .y = y };
+
+    client->gridded = true;
+    client->grid_x = x;
+    client->grid_y = y;
+    mutex_release(self->cells.mutex);
+}
+
+void grid_remove(grid_t *self, client_t *client) {
+    mutex_lock(self->cells.mutex);
+    if (client->gridded) {
+        grid_cell_remove(self, grid_key(grid_coordinate(self, client->grid_x), grid_coordinate(self, client->grid_y)), client->handle);
+        client->gridded = false;
+    }
+    mutex_release(self->cells.mutex);
+}
+
+client_t **grid_query(grid_t *self, float x, float y, float radius, uint32_t *count) {
+    int32_t x0 = grid_coordinate(self, x - radius), x1 = grid_coordinate(self, x + radius);
+    int32_t y0 = grid_coordinate(self, y - radius), y1 = grid_coordinate(self, y + radius);
+
+    uint32_t found = 0, capacity = GRID_CELL_DEFAULT_SIZE;
+    client_handle_t *handles = malloc(capacity * sizeof(client_handle_t));
+
+    mutex_lock(self->cells.mutex);
+    // Large radii cover more cells than are occupied, walk the occupied ones instead
+    if ((uint64_t)((int64_t)x1 - x0 + 1) * (uint64_t)((int64_t)y1 - y0 + 1) > self->cells.pair_count) {
+        uint32_t pair_count = 0;
+        pair_t **pairs = hashtable_pairs(&self->cells, &pair_count);
+        for (pair_t **pl = pairs; pl < pairs + pair_count; ++pl)
+            grid_cell_collect((*pl)->value, x, y, radius * radius, &handles, &found, &capacity);
+        free(pairs);
+    } else {
+        // Ranges can end at INT32_MAX once clamped, so they are walked wider
+        for (int64_t cx = x0; cx <= x1; ++cx) {
+            for (int64_t cy = y0; cy <= y1; ++cy) {
+                uint64_t key = grid_key(cx, cy);
+                grid_cell_t *cell = hashtable_get(&self->cells, &key);
+                if (cell)
+                    grid_cell_collect(cell, x, y, radius * radius, &handles, &found, &capacity);
+            }
+        }
+    }
+    mutex_release(self->cells.mutex);
+
+    client_t **clients = malloc((found ? found : 1) * sizeof(client_t *));
+    registry_get_many(&server.clients, handles, found, clients);
+    free(handles);
+
+    // Clients may have disconnected since the grid was read
+    *count = 0;
+    for (uint32_t i = 0; i < found; ++i) {
+        if (clients[i])
+            clients[(*count)++] = clients[i];
+    }
+    return clients;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "../data/hashtable.h"
+#include "registry.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define GRID_DEFAULT_CELL_SIZE 64
+#define GRID_DEFAULT_RADIUS 128
+/// Initial capacity of a cell's member array.
+#define GRID_CELL_DEFAULT_SIZE 8
+
+typedef struct grid_member_t {
+    client_handle_t handle;
+    float x, y;
+} grid_member_t;
+
+/// Clients within one cell, kept contiguous with their positions for fast radius checks.
+typedef struct grid_cell_t {
+    grid_member_t *members;
+    uint32_t count, capacity;
+} grid_cell_t;
+
+/// Sparse uniform grid of client positions, only occupied cells are stored.
+/// Cells are keyed by their packed x and y coordinates.
+typedef struct grid_t {
+    float cell_size, radius;
+    hashtable_t cells;
+} grid_t;
+
+/// Create and allocate a grid, radius is the default interest radius.
+grid_t grid_new(float cell_size, float radius);
+/// Clean up after a grid and every cell in it.
+void grid_delete(grid_t *self);
+
+/// Place a client in the grid or move it to a new position.
+void grid_move(grid_t *self, client_t *client, float x, float y);
+/// Take a client out of the grid, does nothing if it isn't in it.
+void grid_remove(grid_t *self, client_t *client);
+
+/// Take a retained copy of every client within radius of a position.
+/// The array must be released with client_snapshot_release.
+client_t **grid_query(grid_t *self, float x, float y, float radius, uint32_t *count);
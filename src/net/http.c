@@ -212,17 +212,12 @@ char *http_server_process_request(struct sockaddr_in address, const char *uri, f
                 return errordoc;
             }
 
-            pair_t **pairs = hashtable_pairs(&server.clients, &count);
-            mutex_lock(server.clients.mutex);
-            for (pair_t **pl = pairs; pl < pairs + count; ++pl) {
-                client_t *client = *(client_t **)(*pl)->value;
-                if (!client->account && client->address.sin_addr.S_un.S_addr == address.sin_addr.S_un.S_addr) {
-                    mutex_lock(client->mutex);
-                    client_verify(client, account, username);
-                    mutex_release(client->mutex);
-                }
+            client_t **clients = client_snapshot(&count);
+            for (client_t **c = clients; c < clients + count; ++c) {
+                if (!(*c)->account && (*c)->address.sin_addr.S_un.S_addr == address.sin_addr.S_un.S_addr)
+                    client_verify(*c, account, username);
             }
-            mutex_release(server.clients.mutex);
+            client_snapshot_release(clients, count);
 
             char *ok = nullptr;
             if (!(res = fs_load("http/verify/ok.html", &ok, size)).is_ok || !ok) {
@@ -0,0 +1,116 @@
+#include "packet.h"
+#include "server.h"
+#include "../api/schema.h"
+#include <stdlib.h>
+#include <string.h>
+
+packet_t *packet_new(const char *data, uint32_t len) {
+    char compressed[MAX_INTERMEDIATE_SIZE];
+    int size = compressor_compress(&server.compressor, data, len, compressed, sizeof(compressed));
+    if (!size) {
+        packet_t *packet = malloc(sizeof(packet_t) + len);
+        packet->references = 1;
+        packet->len = len;
+        packet->type = INTERMEDIATE_TYPE_OFFSET;
+        packet->symbolic = nullptr;
+        memcpy(packet->data, data, len);
+        return packet;
+    }
+
+    // The type can't be read from a compressed frame, so it is kept after it
+    const char *type = data + INTERMEDIATE_TYPE_OFFSET;
+    uint32_t type_len = strlen(type) + 1;
+    packet_t *packet = malloc(sizeof(packet_t) + size + type_len);
+    packet->references = 1;
+    packet->len = size;
+    packet->type = size;
+    packet->symbolic = nullptr;
+    memcpy(packet->data, compressed, size);
+    memcpy(packet->data + size, type, type_len);
+    return packet;
+}
+
+packet_t *packet_raw(const char *data, uint32_t len) {
+    // Ends with an empty type so packet_type still gives a string
+    packet_t *packet = malloc(sizeof(packet_t) + len + 1);
+    packet->references = 1;
+    packet->len = len;
+    packet->type = len;
+    packet->symbolic = nullptr;
+    memcpy(packet->data, data, len);
+    packet->data[len] = '\0';
+    return packet;
+}
+
+packet_t *packet_wrap(const char *prefix, uint32_t prefix_len, packet_t *inner) {
+    // Compressed packets keep their type past the end of the frame, which has to come along
+    uint32_t extent = inner->len;
+    if (inner->type >= inner->len)
+        extent = inner->type + strlen(inner->data + inner->type) + 1;
+
+    packet_t *packet = malloc(sizeof(packet_t) + prefix_len + extent);
+    packet->references = 1;
+    packet->len = prefix_len + inner->len;
+    packet->type = prefix_len + inner->type;
+    packet->symbolic = nullptr;
+    memcpy(packet->data, prefix, prefix_len);
+    memcpy(packet->data + prefix_len, inner->data, extent);
+    return packet;
+}
+
+packet_t *packet_bundle(packet_t **packets, uint32_t count) {
+    const char *frames[INTERMEDIATE_MAX_BUNDLE];
+    int lens[INTERMEDIATE_MAX_BUNDLE];
+    uint32_t len = INTERMEDIATE_BUNDLE_HEADER_SIZE;
+    for (uint32_t i = 0; i < count; ++i) {
+        frames[i] = packets[i]->data;
+        lens[i] = packets[i]->len;
+        len += sizeof(uint16_t) + lens[i];
+    }
+
+    // Ends with an empty type like packet_raw, bundles are never queued where their type matters
+    packet_t *packet = malloc(sizeof(packet_t) + len + 1);
+    packet->references = 1;
+    packet->len = len;
+    packet->type = len;
+    packet->symbolic = nullptr;
+    intermediate_bundle_write(frames, lens, count, packet->data, len);
+    packet->data[len] = '\0';
+    return packet;
+}
+
+packet_t *packet_from_intermediate(intermediate_t *intermediate) {
+    int len = 0;
+    const char *buffer = intermediate_to_scratch(intermediate, false, &len);
+    packet_t *packet = packet_new(buffer, len);
+
+    bool compact = schema_find(intermediate->type);
+    for (intermediate_variable_t *var = intermediate->variables; var && !compact; var = var->next)
+        compact = var->symbol >= 0 && !var->internal;
+
+    if (compact) {
+        buffer = intermediate_to_scratch(intermediate, true, &len);
+        packet->symbolic = packet_new(buffer, len);
+    }
+    return packet;
+}
+
+void packet_delete(packet_t *self) {
+    if (self->symbolic)
+        packet_release(self->symbolic);
+    free(self);
+}
+
+packet_t *packet_retain(packet_t *self) {
+    InterlockedIncrement(&self->references);
+    return self;
+}
+
+void packet_release(packet_t *self) {
+    if (InterlockedDecrement(&self->references) == 0)
+        packet_delete(self);
+}
+
+const char *packet_type(packet_t *self) {
+    return self->data + self->type;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "../api/intermediate.h"
+#include "../util/win32.h"
+#include <stdint.h>
+
+/// An encoded intermediate waiting to be sent.
+/// Packets are immutable and reference counted so one encoding can be queued to many clients.
+typedef struct packet_t {
+    volatile LONG references;
+    uint32_t len;
+    // Offset of the event type in data, compressed packets keep a copy past the end of the frame
+    uint32_t type;
+    // The same frame with symbol coded names or in its schema's layout, for clients that accepted the symbols.
+    // nullptr if there is neither
+    struct packet_t *symbolic;
+    char data[];
+} packet_t;
+
+/// Create a packet holding a copy of an encoded frame, with one reference.
+/// The frame is compressed if the server's compressor finds it worth it.
+packet_t *packet_new(const char *data, uint32_t len);
+/// Create a packet holding a copy of data that isn't a frame and is never compressed, with one reference.
+packet_t *packet_raw(const char *data, uint32_t len);
+/// Create a packet holding a prefix followed by another packet's data, with one reference.
+/// The event type stays that of the wrapped packet.
+packet_t *packet_wrap(const char *prefix, uint32_t prefix_len, packet_t *inner);
+/// Create a packet bundling the frames of several packets, with one reference.
+/// At most INTERMEDIATE_MAX_BUNDLE packets may be bundled, and the bundle has to fit in MAX_INTERMEDIATE_SIZE.
+packet_t *packet_bundle(packet_t **packets, uint32_t count);
+/// Encode an intermediate into a new packet, with one reference.
+/// A compact encoding is kept alongside if any of its names have a symbol or its type has a schema.
+packet_t *packet_from_intermediate(intermediate_t *intermediate);
+void packet_delete(packet_t *self);
+
+/// Take a reference to a packet.
+packet_t *packet_retain(packet_t *self);
+/// Drop a reference to a packet, deleting it when none remain.
+void packet_release(packet_t *self);
+
+/// The event type of the frame held by a packet.
+const char *packet_type(packet_t *self);
@@ -0,0 +1,249 @@
+#include "registry.h"
+#include "client.h"
+#include "../data/crypto.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REGISTRY_EMPTY 0
+#define REGISTRY_TOMBSTONE UINT32_MAX
+#define REGISTRY_NONE UINT32_MAX
+
+static uint32_t registry_hash_address(struct sockaddr_in address) {
+    // 64 bit finalizer over the packed ip and port
+    uint64_t key = ((uint64_t)address.sin_addr.s_addr << 16) | address.sin_port;
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return (uint32_t)key;
+}
+
+static bool registry_match_uuid(client_t *client, const void *key) {
+    return memcmp(client->uuid, key, UUID_LENGTH) == 0;
+}
+
+static bool registry_match_address(client_t *client, const void *key) {
+    const struct sockaddr_in *address = key;
+    return client->address.sin_addr.s_addr == address->sin_addr.s_addr && client->address.sin_port == address->sin_port;
+}
+
+static registry_index_t registry_index_new(uint32_t capacity) {
+    return (registry_index_t) {
+        .slots = calloc(capacity, sizeof(uint32_t)),
+        .capacity = capacity,
+        .used = 0,
+    };
+}
+
+static void registry_index_insert(registry_index_t *index, uint32_t hash, uint32_t slot) {
+    for (uint32_t i = hash & (index->capacity - 1);; i = (i + 1) & (index->capacity - 1)) {
+        if (index->slots[i] == REGISTRY_EMPTY || index->slots[i] == REGISTRY_TOMBSTONE) {
+            if (index->slots[i] == REGISTRY_EMPTY)
+                index->used++;
+            index->slots[i] = slot + 1;
+            return;
+        }
+    }
+}
+
+static uint32_t *registry_index_find(registry_t *self, registry_index_t *index, uint32_t hash, bool (*match)(client_t *, const void *), const void *key) {
+    for (uint32_t i = hash & (index->capacity - 1);; i = (i + 1) & (index->capacity - 1)) {
+        uint32_t slot = index->slots[i];
+        if (slot == REGISTRY_EMPTY)
+            return nullptr;
+        if (slot != REGISTRY_TOMBSTONE && match(self->slots[slot - 1].client, key))
+            return &index->slots[i];
+    }
+}
+
+/// Rebuild both indices from the dense array, dropping tombstones.
+static void registry_reindex(registry_t *self, uint32_t capacity) {
+    free(self->uuids.slots);
+    free(self->addresses.slots);
+    self->uuids = registry_index_new(capacity);
+    self->addresses = registry_index_new(capacity);
+
+    for (uint32_t i = 0; i < self->count; ++i) {
+        client_t *client = self->dense[i];
+        uint32_t slot = (uint32_t)client->handle;
+        registry_index_insert(&self->uuids, jhash(client->uuid, UUID_LENGTH), slot);
+        registry_index_insert(&self->addresses, registry_hash_address(client->address), slot);
+    }
+}
+
+static void registry_grow(registry_t *self) {
+    uint32_t old = self->capacity;
+    self->capacity *= 2;
+    self->slots = realloc(self->slots, self->capacity * sizeof(registry_slot_t));
+    self->dense = realloc(self->dense, self->capacity * sizeof(client_t *));
+
+    for (uint32_t i = old; i < self->capacity; ++i) {
+        self->slots[i] = (registry_slot_t) {
+            .client = nullptr,
+            .generation = 1,
+            .link = i + 1 < self->capacity ? i + 1 : self->free,
+        };
+    }
+    self->free = old;
+
+    registry_reindex(self, self->capacity * 2);
+}
+
+registry_t registry_new(void) {
+    registry_t registry = {
+        .mutex = mutex_new(),
+        .slots = calloc(REGISTRY_DEFAULT_SIZE, sizeof(registry_slot_t)),
+        .capacity = REGISTRY_DEFAULT_SIZE,
+        .free = 0,
+        .dense = calloc(REGISTRY_DEFAULT_SIZE, sizeof(client_t *)),
+        .count = 0,
+        .uuids = registry_index_new(REGISTRY_DEFAULT_SIZE * 2),
+        .addresses = registry_index_new(REGISTRY_DEFAULT_SIZE * 2),
+    };
+
+    for (uint32_t i = 0; i < REGISTRY_DEFAULT_SIZE; ++i) {
+        registry.slots[i] = (registry_slot_t) {
+            .client = nullptr,
+            .generation = 1,
+            .link = i + 1 < REGISTRY_DEFAULT_SIZE ? i + 1 : REGISTRY_NONE,
+        };
+    }
+
+    return registry;
+}
+
+void registry_delete(registry_t *self) {
+    if (!self->slots)
+        return;
+
+    mutex_lock(self->mutex);
+    free(self->slots);
+    free(self->dense);
+    free(self->uuids.slots);
+    free(self->addresses.slots);
+    mutex_release(self->mutex);
+
+    mutex_delete(self->mutex);
+    *self = (registry_t) { 0 };
+}
+
+client_handle_t registry_insert(registry_t *self, client_t *client) {
+    mutex_lock(self->mutex);
+    if (self->free == REGISTRY_NONE)
+        registry_grow(self);
+    // Keep the indices at most three quarters full, counting tombstones.
+    // Rebuilt before the client joins the dense array, so it's only indexed once below.
+    if ((self->uuids.used + 1) * 4 > self->uuids.capacity * 3)
+        registry_reindex(self, self->uuids.capacity);
+
+    uint32_t slot = self->free;
+    registry_slot_t *s = &self->slots[slot];
+    self->free = s->link;
+
+    s->client = client;
+    s->link = self->count;
+    self->dense[self->count++] = client;
+    client->handle = ((client_handle_t)s->generation << 32) | slot;
+
+    registry_index_insert(&self->uuids, jhash(client->uuid, UUID_LENGTH), slot);
+    registry_index_insert(&self->addresses, registry_hash_address(client->address), slot);
+
+    mutex_release(self->mutex);
+    return client->handle;
+}
+
+void registry_remove(registry_t *self, client_handle_t handle) {
+    uint32_t slot = (uint32_t)handle;
+
+    mutex_lock(self->mutex);
+    if (slot >= self->capacity || self->slots[slot].generation != handle >> 32 || !self->slots[slot].client) {
+        mutex_release(self->mutex);
+        return;
+    }
+    registry_slot_t *s = &self->slots[slot];
+    client_t *client = s->client;
+
+    uint32_t *entry = registry_index_find(self, &self->uuids, jhash(client->uuid, UUID_LENGTH), registry_match_uuid, client->uuid);
+    if (entry)
+        *entry = REGISTRY_TOMBSTONE;
+    entry = registry_index_find(self, &self->addresses, registry_hash_address(client->address), registry_match_address, &client->address);
+    if (entry)
+        *entry = REGISTRY_TOMBSTONE;
+
+    // Swap the last dense entry into the hole
+    client_t *last = self->dense[--self->count];
+    self->dense[s->link] = last;
+    self->slots[(uint32_t)last->handle].link = s->link;
+
+    // Slots whose generation would wrap are retired rather than reused
+    s->client = nullptr;
+    if (++s->generation != 0) {
+        s->link = self->free;
+        self->free = slot;
+    }
+
+    mutex_release(self->mutex);
+}
+
+client_t *registry_get(registry_t *self, client_handle_t handle) {
+    uint32_t slot = (uint32_t)handle;
+    client_t *client = nullptr;
+
+    mutex_lock(self->mutex);
+    if (slot < self->capacity && self->slots[slot].generation == handle >> 32 && (client = self->slots[slot].client))
+        client_retain(client);
+    mutex_release(self->mutex);
+
+    return client;
+}
+
+void registry_get_many(registry_t *self, const client_handle_t *handles, uint32_t count, client_t **out) {
+    mutex_lock(self->mutex);
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t slot = (uint32_t)handles[i];
+        out[i] = nullptr;
+        if (slot < self->capacity && self->slots[slot].generation == handles[i] >> 32 && (out[i] = self->slots[slot].client))
+            client_retain(out[i]);
+    }
+    mutex_release(self->mutex);
+}
+
+client_t *registry_find_uuid(registry_t *self, const char *uuid) {
+    client_t *client = nullptr;
+    if (strlen(uuid) != UUID_LENGTH)
+        return nullptr;
+
+    mutex_lock(self->mutex);
+    uint32_t *entry = registry_index_find(self, &self->uuids, jhash(uuid, UUID_LENGTH), registry_match_uuid, uuid);
+    if (entry && (client = self->slots[*entry - 1].client))
+        client_retain(client);
+    mutex_release(self->mutex);
+
+    return client;
+}
+
+client_t *registry_find_address(registry_t *self, struct sockaddr_in address) {
+    client_t *client = nullptr;
+
+    mutex_lock(self->mutex);
+    uint32_t *entry = registry_index_find(self, &self->addresses, registry_hash_address(address), registry_match_address, &address);
+    if (entry && (client = self->slots[*entry - 1].client))
+        client_retain(client);
+    mutex_release(self->mutex);
+
+    return client;
+}
+
+client_t **registry_snapshot(registry_t *self, uint32_t *count) {
+    mutex_lock(self->mutex);
+    client_t **clients = malloc((self->count ? self->count : 1) * sizeof(client_t *));
+    memcpy(clients, self->dense, self->count * sizeof(client_t *));
+    for (uint32_t i = 0; i < self->count; ++i)
+        client_retain(clients[i]);
+    *count = self->count;
+    mutex_release(self->mutex);
+
+    return clients;
+}
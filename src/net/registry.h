@@ -0,0 +1,63 @@
+#pragma once
+#include "../data/mutex.h"
+#include <stdint.h>
+#include <winsock2.h>
+
+#define REGISTRY_DEFAULT_SIZE 64
+
+/// Compact client handle, the slot index in the low half and its generation in the high half.
+/// A slot's generation changes every time it is freed, so stale handles never match a new occupant.
+typedef uint64_t client_handle_t;
+#define CLIENT_HANDLE_NONE 0
+
+typedef struct client_t client_t;
+
+typedef struct registry_slot_t {
+    client_t *client;
+    uint32_t generation;
+    // Position in the dense array while occupied, next free slot otherwise
+    uint32_t link;
+} registry_slot_t;
+
+/// Open addressing index from a key to a slot.
+typedef struct registry_index_t {
+    uint32_t *slots;
+    // Used counts tombstones as well, they are only cleared by a rebuild
+    uint32_t capacity, used;
+} registry_index_t;
+
+/// Slot array of connected clients.
+/// Occupied slots are mirrored in a dense array for iteration, and indexed by uuid and address.
+typedef struct registry_t {
+    mutex_t mutex;
+    registry_slot_t *slots;
+    uint32_t capacity, free;
+
+    client_t **dense;
+    uint32_t count;
+
+    registry_index_t uuids, addresses;
+} registry_t;
+
+/// Create and allocate a registry.
+registry_t registry_new(void);
+/// Clean up after a registry, clients aren't released.
+void registry_delete(registry_t *self);
+
+/// Insert a client, returning its new handle.
+client_handle_t registry_insert(registry_t *self, client_t *client);
+/// Remove the client with the given handle, stale handles are ignored.
+void registry_remove(registry_t *self, client_handle_t handle);
+
+/// Look up a client by handle, returns a retained client or nullptr.
+client_t *registry_get(registry_t *self, client_handle_t handle);
+/// Look up many clients by handle under a single lock, retaining every one found.
+/// Stale handles give nullptr in out.
+void registry_get_many(registry_t *self, const client_handle_t *handles, uint32_t count, client_t **out);
+/// Look up a client by uuid, returns a retained client or nullptr.
+client_t *registry_find_uuid(registry_t *self, const char *uuid);
+/// Look up a client by address, returns a retained client or nullptr.
+client_t *registry_find_address(registry_t *self, struct sockaddr_in address);
+
+/// Copy and retain every client, the array must be freed by the caller.
+client_t **registry_snapshot(registry_t *self, uint32_t *count);
@@ -0,0 +1,175 @@
+#include "reliable.h"
+#include "../api/intermediate.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Distance from b forward to a, negative if a is older.
+static int16_t reliable_distance(uint16_t a, uint16_t b) {
+    return (int16_t)(a - b);
+}
+
+static bool reliable_received(reliable_lane_t *lane, uint16_t sequence) {
+    if (reliable_distance(sequence, lane->base) < 0)
+        return true;
+    uint16_t slot = sequence % RELIABLE_WINDOW;
+    return lane->received[slot / 8] & (1 << (slot % 8));
+}
+
+static void reliable_mark(reliable_lane_t *lane, uint16_t sequence, bool received) {
+    uint16_t slot = sequence % RELIABLE_WINDOW;
+    if (received)
+        lane->received[slot / 8] |= 1 << (slot % 8);
+    else
+        lane->received[slot / 8] &= ~(1 << (slot % 8));
+}
+
+reliable_t *reliable_new(void) {
+    reliable_t *reliable = calloc(1, sizeof(reliable_t));
+    reliable->rto = RELIABLE_INITIAL_RTO;
+    return reliable;
+}
+
+void reliable_delete(reliable_t *self) {
+    for (reliable_lane_t *lane = self->lanes; lane < self->lanes + RELIABLE_LANES; ++lane) {
+        for (uint32_t i = 0; i < RELIABLE_WINDOW; ++i) {
+            if (lane->pending[i].packet)
+                packet_release(lane->pending[i].packet);
+            free(lane->buffered[i]);
+        }
+    }
+    free(self);
+}
+
+packet_t *reliable_send(reliable_t *self, reliable_lane_e lane, packet_t *frame, uint64_t now) {
+    reliable_lane_t *l = &self->lanes[lane];
+    if ((uint16_t)(l->next - l->oldest) >= RELIABLE_WINDOW)
+        return nullptr;
+
+    char header[RELIABLE_HEADER_SIZE] = { (char)INTERMEDIATE_RELIABLE, (char)lane };
+    memcpy(header + sizeof(char) * 2, &l->next, sizeof(uint16_t));
+
+    packet_t *packet = packet_wrap(header, sizeof(header), frame);
+    l->pending[l->next % RELIABLE_WINDOW] = (reliable_pending_t) {
+        .packet = packet_retain(packet),
+        .sent = now,
+        .retries = 0,
+    };
+    l->next++;
+
+    return packet;
+}
+
+/// Acknowledge a single sequence, sampling the round trip if it was never retransmitted.
+static void reliable_acknowledge(reliable_t *self, reliable_lane_t *lane, uint16_t sequence, uint64_t now) {
+    if (reliable_distance(sequence, lane->oldest) < 0 || reliable_distance(sequence, lane->next) >= 0)
+        return;
+
+    reliable_pending_t *pending = &lane->pending[sequence % RELIABLE_WINDOW];
+    if (!pending->packet)
+        return;
+
+    // Karn's algorithm, retransmitted packets give ambiguous samples
+    if (!pending->retries) {
+        double sample = (double)(now - pending->sent);
+        if (self->srtt == 0) {
+            self->srtt = sample;
+            self->rttvar = sample / 2;
+        } else {
+            self->rttvar = 0.75 * self->rttvar + 0.25 * fabs(self->srtt - sample);
+            self->srtt = 0.875 * self->srtt + 0.125 * sample;
+        }
+        double rto = self->srtt + 4 * self->rttvar;
+        self->rto = rto < RELIABLE_MIN_RTO ? RELIABLE_MIN_RTO : rto > RELIABLE_MAX_RTO ? RELIABLE_MAX_RTO : (uint64_t)rto;
+    }
+
+    packet_release(pending->packet);
+    pending->packet = nullptr;
+}
+
+void reliable_on_ack(reliable_t *self, reliable_lane_e lane, uint16_t sequence, uint32_t bits, uint64_t now) {
+    reliable_lane_t *l = &self->lanes[lane];
+    reliable_acknowledge(self, l, sequence, now);
+    for (uint32_t i = 0; i < 32; ++i) {
+        if (bits & (1u << i))
+            reliable_acknowledge(self, l, sequence - 1 - i, now);
+    }
+
+    while (l->oldest != l->next && !l->pending[l->oldest % RELIABLE_WINDOW].packet)
+        l->oldest++;
+}
+
+int reliable_due(reliable_t *self, uint64_t now, packet_t **out, uint32_t capacity) {
+    uint32_t count = 0;
+    for (reliable_lane_t *lane = self->lanes; lane < self->lanes + RELIABLE_LANES; ++lane) {
+        for (uint16_t sequence = lane->oldest; sequence != lane->next && count < capacity; ++sequence) {
+            reliable_pending_t *pending = &lane->pending[sequence % RELIABLE_WINDOW];
+            if (!pending->packet)
+                continue;
+
+            // Back off exponentially while a packet keeps getting lost
+            uint64_t timeout = self->rto << (pending->retries < 4 ? pending->retries : 4);
+            if (now - pending->sent < timeout)
+                continue;
+            if (++pending->retries > RELIABLE_MAX_RETRIES)
+                return -1;
+
+            pending->sent = now;
+            out[count++] = packet_retain(pending->packet);
+        }
+    }
+    return count;
+}
+
+int reliable_receive(reliable_t *self, reliable_lane_e lane, uint16_t sequence, const char *frame, uint16_t len) {
+    reliable_lane_t *l = &self->lanes[lane];
+    if (reliable_distance(sequence, l->base) >= RELIABLE_WINDOW)
+        return -1;
+    if (reliable_received(l, sequence))
+        return 0;
+
+    reliable_mark(l, sequence, true);
+    if (lane == RELIABLE_ORDERED) {
+        uint16_t slot = sequence % RELIABLE_WINDOW;
+        l->buffered[slot] = malloc(len);
+        l->buffered_len[slot] = len;
+        memcpy(l->buffered[slot], frame, len);
+        return 1;
+    }
+
+    // Unordered lanes deliver right away, the base only tracks what is still missing
+    while (reliable_received(l, l->base)) {
+        reliable_mark(l, l->base, false);
+        l->base++;
+    }
+    return 1;
+}
+
+char *reliable_next(reliable_t *self, reliable_lane_e lane, uint16_t *len) {
+    reliable_lane_t *l = &self->lanes[lane];
+    uint16_t slot = l->base % RELIABLE_WINDOW;
+    if (!l->buffered[slot])
+        return nullptr;
+
+    char *frame = l->buffered[slot];
+    *len = l->buffered_len[slot];
+    l->buffered[slot] = nullptr;
+    reliable_mark(l, l->base, false);
+    l->base++;
+    return frame;
+}
+
+int reliable_ack(reliable_t *self, reliable_lane_e lane, uint16_t sequence, char out[RELIABLE_ACK_SIZE]) {
+    reliable_lane_t *l = &self->lanes[lane];
+    uint32_t bits = 0;
+    for (uint32_t i = 0; i < 32; ++i) {
+        if (reliable_received(l, sequence - 1 - i))
+            bits |= 1u << i;
+    }
+
+    out[0] = (char)INTERMEDIATE_ACK;
+    out[1] = (char)lane;
+    memcpy(out + sizeof(char) * 2, &sequence, sizeof(uint16_t));
+    memcpy(out + sizeof(char) * 2 + sizeof(uint16_t), &bits, sizeof(uint32_t));
+    return RELIABLE_ACK_SIZE;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "packet.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Amount of sequences a lane may have in flight, must be a power of two.
+#define RELIABLE_WINDOW 256
+/// Retransmission timeouts in milliseconds.
+#define RELIABLE_INITIAL_RTO 200
+#define RELIABLE_MIN_RTO 30
+#define RELIABLE_MAX_RTO 2000
+/// Retransmissions of one packet before the client is considered gone.
+#define RELIABLE_MAX_RETRIES 16
+/// How often pending packets are checked for retransmission, in milliseconds.
+#define RELIABLE_INTERVAL 10
+
+/// Control byte, lane and sequence in front of a reliable frame.
+#define RELIABLE_HEADER_SIZE (sizeof(char) * 2 + sizeof(uint16_t))
+/// Control byte, lane, sequence and the bits of the 32 sequences before it.
+#define RELIABLE_ACK_SIZE (sizeof(char) * 2 + sizeof(uint16_t) + sizeof(uint32_t))
+
+typedef enum reliable_lane_e {
+    RELIABLE_ORDERED,
+    RELIABLE_UNORDERED,
+    RELIABLE_LANES,
+} reliable_lane_e;
+
+typedef struct reliable_pending_t {
+    packet_t *packet;
+    uint64_t sent;
+    uint32_t retries;
+} reliable_pending_t;
+
+/// One direction independent stream of sequences.
+typedef struct reliable_lane_t {
+    // Sending, sequences from oldest up to next are in flight
+    uint16_t next, oldest;
+    reliable_pending_t pending[RELIABLE_WINDOW];
+
+    // Receiving, everything before base has been received and delivered
+    uint16_t base;
+    uint8_t received[RELIABLE_WINDOW / 8];
+    char *buffered[RELIABLE_WINDOW];
+    uint16_t buffered_len[RELIABLE_WINDOW];
+    bool delivering;
+} reliable_lane_t;
+
+/// Reliable channel of a client over UDP, with one round trip estimate shared by both lanes.
+typedef struct reliable_t {
+    reliable_lane_t lanes[RELIABLE_LANES];
+    double srtt, rttvar;
+    uint64_t rto;
+} reliable_t;
+
+/// Create a reliable channel.
+reliable_t *reliable_new(void);
+/// Free a reliable channel and everything still pending or buffered in it.
+void reliable_delete(reliable_t *self);
+
+/// Wrap a frame in a reliable header and remember it until it is acknowledged.
+/// Returns the packet to send, or nullptr if the lane's window is full.
+packet_t *reliable_send(reliable_t *self, reliable_lane_e lane, packet_t *frame, uint64_t now);
+/// Apply an acknowledgement of a sequence and the 32 before it.
+void reliable_on_ack(reliable_t *self, reliable_lane_e lane, uint16_t sequence, uint32_t bits, uint64_t now);
+/// Collect retained packets whose timeout has passed, at most capacity.
+/// Returns how many were collected, or -1 if a packet ran out of retries.
+int reliable_due(reliable_t *self, uint64_t now, packet_t **out, uint32_t capacity);
+
+/// Record a received sequence, buffering its frame if the lane is ordered.
+/// Returns 1 if it is new, 0 if it is a duplicate and -1 if it is too far ahead to accept.
+int reliable_receive(reliable_t *self, reliable_lane_e lane, uint16_t sequence, const char *frame, uint16_t len);
+/// Pop the next frame of an ordered lane that can be delivered, the frame must be freed.
+/// Returns nullptr if the next sequence hasn't arrived.
+char *reliable_next(reliable_t *self, reliable_lane_e lane, uint16_t *len);
+/// Write an acknowledgement of a sequence, returns its length.
+int reliable_ack(reliable_t *self, reliable_lane_e lane, uint16_t sequence, char out[RELIABLE_ACK_SIZE]);
@@ -0,0 +1,109 @@
+#include "rooms.h"
+#include "client.h"
+#include "server.h"
+#include <stdlib.h>
+#include <string.h>
+
+rooms_t rooms_new(void) {
+    return (rooms_t) {
+        .rooms = hashtable_string(),
+    };
+}
+
+void rooms_delete(rooms_t *self) {
+    if (!self->rooms.buckets)
+        return;
+
+    uint32_t count = 0;
+    pair_t **pairs = hashtable_pairs(&self->rooms, &count);
+    for (pair_t **pl = pairs; pl < pairs + count; ++pl)
+        free(((room_t *)(*pl)->value)->members);
+    free(pairs);
+
+    hashtable_delete(&self->rooms);
+    *self = (rooms_t) { 0 };
+}
+
+bool rooms_join(rooms_t *self, const char *name, client_handle_t handle) {
+    mutex_lock(self->rooms.mutex);
+    room_t *room = hashtable_get(&self->rooms, (void *)name);
+    if (!room) {
+        room_t empty = {
+            .members = malloc(ROOM_DEFAULT_SIZE * sizeof(client_handle_t)),
+            .count = 0,
+            .capacity = ROOM_DEFAULT_SIZE,
+        };
+        room = hashtable_insert(&self->rooms, (void *)name, &empty, sizeof(room_t));
+    }
+
+    for (uint32_t i = 0; i < room->count; ++i) {
+        if (room->members[i] == handle) {
+            mutex_release(self->rooms.mutex);
+            return false;
+        }
+    }
+
+    if (room->count == room->capacity) {
+        room->capacity *= 2;
+        room->members = realloc(room->members, room->capacity * sizeof(client_handle_t));
+    }
+    room->members[room->count++] = handle;
+
+    mutex_release(self->rooms.mutex);
+    return true;
+}
+
+/// Delete a room once its last member is gone, must be called with the rooms locked.
+static void rooms_prune(rooms_t *self, const char *name, room_t *room) {
+    if (room->count)
+        return;
+    free(room->members);
+    hashtable_remove(&self->rooms, (void *)name);
+}
+
+bool rooms_leave(rooms_t *self, const char *name, client_handle_t handle) {
+    mutex_lock(self->rooms.mutex);
+    room_t *room = hashtable_get(&self->rooms, (void *)name);
+    if (room) {
+        for (uint32_t i = 0; i < room->count; ++i) {
+            if (room->members[i] == handle) {
+                room->members[i] = room->members[--room->count];
+                rooms_prune(self, name, room);
+                mutex_release(self->rooms.mutex);
+                return true;
+            }
+        }
+    }
+
+    mutex_release(self->rooms.mutex);
+    return false;
+}
+
+client_t **rooms_snapshot(rooms_t *self, const char *name, uint32_t *count) {
+    *count = 0;
+
+    mutex_lock(self->rooms.mutex);
+    room_t *room = hashtable_get(&self->rooms, (void *)name);
+    if (!room) {
+        mutex_release(self->rooms.mutex);
+        return calloc(1, sizeof(client_t *));
+    }
+
+    client_t **clients = malloc(room->count * sizeof(client_t *));
+    uint32_t members = room->count;
+    registry_get_many(&server.clients, room->members, members, clients);
+
+    // Drop members that have disconnected since they joined, walking backwards keeps the swaps safe
+    for (uint32_t i = members; i-- > 0;) {
+        if (!clients[i])
+            room->members[i] = room->members[--room->count];
+    }
+    rooms_prune(self, name, room);
+    mutex_release(self->rooms.mutex);
+
+    for (uint32_t i = 0; i < members; ++i) {
+        if (clients[i])
+            clients[(*count)++] = clients[i];
+    }
+    return clients;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "../data/hashtable.h"
+#include "registry.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ROOM_DEFAULT_SIZE 8
+
+/// Members of a room, kept as a contiguous array of client handles.
+/// Handles of disconnected clients are dropped the next time the room is walked.
+typedef struct room_t {
+    client_handle_t *members;
+    uint32_t count, capacity;
+} room_t;
+
+/// Named rooms, created on the first join and deleted once empty.
+typedef struct rooms_t {
+    hashtable_t rooms;
+} rooms_t;
+
+/// Create and allocate a set of rooms.
+rooms_t rooms_new(void);
+/// Clean up after every room.
+void rooms_delete(rooms_t *self);
+
+/// Add a client to a room, returns false if it already was a member.
+bool rooms_join(rooms_t *self, const char *name, client_handle_t handle);
+/// Remove a client from a room, returns false if it wasn't a member.
+bool rooms_leave(rooms_t *self, const char *name, client_handle_t handle);
+
+/// Take a retained copy of every connected member of a room.
+/// The array must be released with client_snapshot_release.
+client_t **rooms_snapshot(rooms_t *self, const char *name, uint32_t *count);
@@ -5,6 +5,7 @@
 #include "../io/console.h"
 #include "../data/stringext.h"
 #include "../api/scripting_api.h"
+#include "../api/schema.h"
 #include "client.h"
 #include <math.h>
 #include <stdlib.h>
@@ -16,17 +17,36 @@ void server_start(void) {
     // Initialize Dependencies
     console_init();
     winsock_init();
-    result_t res = scripting_api_new(&server.api);
+    result_t res = scripting_api_new(&server.api, 0);
     if (!res.is_ok) {
         console_error(res.description);
         result_discard(res);
         server_stop();
     }
+    for (uint32_t i = 1; i < scripting_shards.count; ++i) {
+        if (!(res = scripting_api_new(calloc(1, sizeof(scripting_api_t)), i)).is_ok) {
+            console_error(res.description);
+            result_discard(res);
+            server_stop();
+        }
+    }
+    scripting_shards.ready = true;
+    if (scripting_shards.count > 1)
+        console_log("Running scripts on %u shards.", scripting_shards.count);
     http_server_init();
 
+    // Scripts have loaded, symbols and schemas are read without locking from here on
+    intermediate_symbols_freeze();
+    if (intermediate_symbols.count)
+        console_log("Defined %u symbols.", intermediate_symbols.count);
+    schemas_freeze();
+    if (schemas.count)
+        console_log("Defined %u schemas.", schemas.count);
+
     // Initialize Server
-    server.clients = hashtable_string();
-    server.clients_addr = hashtable_string();
+    server.clients = registry_new();
+    server.rooms = rooms_new();
+    stats_init(&server.stats);
 
     float max_players;
     if (!(res = scripting_api_config_number(&server.api, "max_players", &max_players, 512)).is_ok) {
@@ -44,8 +64,26 @@ void server_start(void) {
     }
     server.login = login;
 
+    float workers;
+    if (!(res = scripting_api_config_number(&server.api, "workers", &workers, 0)).is_ok) {
+        console_error(res.description);
+        result_discard(res);
+        server_stop();
+    }
+    if (!(res = engine_init(&server.engine, workers)).is_ok) {
+        console_error(res.description);
+        result_discard(res);
+        server_stop();
+    }
+
+    server_init_rate_limits();
+    server_init_send_queues();
+    server_init_tick();
+    server_init_grid();
+    server_init_compression();
     server_init_tcp();
     server_init_udp();
+    server_init_reliable();
 
     console_header("Starting Server");
     server_listen_tcp();
@@ -99,15 +137,205 @@ void server_init_udp(void) {
         winsock_console_error();
         server_stop();
     }
-    server.udp_thread = CreateThread(nullptr, 0, (LPTHREAD_START_ROUTINE)server_listen_udp, nullptr, 0, nullptr);
+
+    float workers;
+    if (!(res = scripting_api_config_number(&server.api, "udp_workers", &workers, 0)).is_ok) {
+        console_error(res.description);
+        result_discard(res);
+        server_stop();
+    }
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    uint32_t processors = info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+    server.udp_worker_count = workers >= 1 ? (uint32_t)workers : processors;
+
+    if (!(res = udp_init(&server.udp, server.udp_socket, server.udp_worker_count)).is_ok) {
+        console_error(res.description);
+        result_discard(res);
+        server_stop();
+    }
+
+    // Every worker waits on the same port, pinned to its own core
+    server.udp_workers = calloc(server.udp_worker_count, sizeof(HANDLE));
+    for (uint32_t i = 0; i < server.udp_worker_count; ++i) {
+        server.udp_workers[i] = CreateThread(nullptr, 0, (LPTHREAD_START_ROUTINE)server_listen_udp, nullptr, 0, nullptr);
+        SetThreadAffinityMask(server.udp_workers[i], (DWORD_PTR)1 << (i % processors % (sizeof(DWORD_PTR) * 8)));
+    }
+    console_log("Listening on UDP port %d with %u workers.", ntohs(server.udp_addr.sin_port), server.udp_worker_count);
+}
+
+void server_init_rate_limits(void) {
+    result_t res;
+    float rate, burst;
+    if (!(res = scripting_api_config_number(&server.api, "rate_limit", &rate, 30)).is_ok
+        || !(res = scripting_api_config_number(&server.api, "rate_burst", &burst, 10)).is_ok) {
+        console_error(res.description);
+        result_discard(res);
+        server_stop();
+    }
+    server.rate_limit = ratelimit_new(rate, burst);
+
+    char *policy;
+    if (!(res = scripting_api_config_string(&server.api, "rate_policy", &policy, "drop")).is_ok) {
+        console_error(res.description);
+        result_discard(res);
+        server_stop();
+    }
+    if (bstrcmp(policy, "defer"))
+        server.rate_policy = RATE_POLICY_DEFER;
+    else if (bstrcmp(policy, "drop"))
+        server.rate_policy = RATE_POLICY_DROP;
+    else {
+        console_warn("Unknown rate policy '%s', dropping events over the limit.", policy);
+        server.rate_policy = RATE_POLICY_DROP;
+    }
+    free(policy);
+
+    // Per event type limits
+    hashtable_t rates = hashtable_string();
+    if (!(res = scripting_api_config_numbers(&server.api, "rate_limits", &rates)).is_ok) {
+        console_error(res.description);
+        result_discard(res);
+        server_stop();
+    }
+
+    server.rate_limits = hashtable_string();
+    uint32_t count = 0;
+    pair_t **pairs = hashtable_pairs(&rates, &count);
+    for (pair_t **pl = pairs; pl < pairs + count; ++pl) {
+        ratelimit_t limit = ratelimit_new(*(float *)(*pl)->value, burst);
+        hashtable_insert(&server.rate_limits, (*pl)->key, &limit, sizeof(ratelimit_t));
+    }
+    free(pairs);
+    hashtable_delete(&rates);
+
+    console_log("Limiting clients to %.1f events per second (%u event specific limits).", rate, count);
+}
+
+void server_init_send_queues(void) {
+    result_t res;
+    float size;
+    if (!(res = scripting_api_config_number(&server.api, "send_queue", &size, SERVER_DEFAULT_SEND_QUEUE)).is_ok) {
+        console_error(res.description);
+        result_discard(res);
+        server_stop();
+    }
+    server.send_queue = size >= 1 ? size : 1;
+
+    char *policy;
+    if (!(res = scripting_api_config_string(&server.api, "slow_policy", &policy, "drop")).is_ok) {
+        console_error(res.description);
+        result_discard(res);
+        server_stop();
+    }
+    if (bstrcmp(policy, "conflate"))
+        server.slow_policy = SLOW_POLICY_CONFLATE;
+    else if (bstrcmp(policy, "disconnect"))
+        server.slow_policy = SLOW_POLICY_DISCONNECT;
+    else if (bstrcmp(policy, "drop"))
+        server.slow_policy = SLOW_POLICY_DROP;
+    else {
+        console_warn("Unknown slow consumer policy '%s', dropping packets to full queues.", policy);
+        server.slow_policy = SLOW_POLICY_DROP;
+    }
+    free(policy);
+}
+
+void server_init_tick(void) {
+    result_t res;
+    float rate;
+    if (!(res = scripting_api_config_number(&server.api, "tick_rate", &rate, 0)).is_ok) {
+        console_error(res.description);
+        result_discard(res);
+        server_stop();
+    }
+    server.tick_rate = rate >= 1 ? (uint32_t)rate : 0;
+    if (!server.tick_rate)
+        return;
+
+    server.tick_io.op = ENGINE_OP_TICK;
+    server.tick_done = CreateEvent(nullptr, false, false, nullptr);
+    server.tick_thread = CreateThread(nullptr, 0, (LPTHREAD_START_ROUTINE)server_tick, nullptr, 0, nullptr);
+    console_log("Ticking %u times per second.", server.tick_rate);
+}
+
+void server_init_grid(void) {
+    result_t res;
+    float cell_size, radius;
+    if (!(res = scripting_api_config_number(&server.api, "grid_cell_size", &cell_size, GRID_DEFAULT_CELL_SIZE)).is_ok
+        || !(res = scripting_api_config_number(&server.api, "interest_radius", &radius, GRID_DEFAULT_RADIUS)).is_ok) {
+        console_error(res.description);
+        result_discard(res);
+        server_stop();
+    }
+    if (cell_size <= 0) {
+        console_warn("Grid cell size must be positive, using %d.", GRID_DEFAULT_CELL_SIZE);
+        cell_size = GRID_DEFAULT_CELL_SIZE;
+    }
+    server.grid = grid_new(cell_size, radius);
+}
+
+void server_init_compression(void) {
+    result_t res;
+    float level, threshold;
+    char *dictionary;
+    if (!(res = scripting_api_config_number(&server.api, "compression_level", &level, 0)).is_ok
+        || !(res = scripting_api_config_number(&server.api, "compression_threshold", &threshold, COMPRESS_DEFAULT_THRESHOLD)).is_ok
+        || !(res = scripting_api_config_string(&server.api, "compression_dictionary", &dictionary, "")).is_ok) {
+        console_error(res.description);
+        result_discard(res);
+        server_stop();
+    }
+
+    if (!(res = compressor_init(&server.compressor, (int)level, threshold > 0 ? (uint32_t)threshold : 0, dictionary)).is_ok) {
+        console_error(res.description);
+        result_discard(res);
+        free(dictionary);
+        server_stop();
+    }
+
+    if (server.compressor.level)
+        console_log("Compressing frames over %u bytes at level %d%s.", server.compressor.threshold, server.compressor.level, server.compressor.dictionary ? " with a dictionary" : "");
+    free(dictionary);
+}
+
+/// Retransmit what every client hasn't acknowledged in time.
+static void CALLBACK server_reliable_timer(unused void *arg, unused BOOLEAN fired) {
+    uint64_t now = GetTickCount64();
+    uint32_t count = 0;
+    client_t **clients = client_snapshot(&count);
+    for (client_t **c = clients; c < clients + count; ++c)
+        client_resend_reliable(*c, now);
+    client_snapshot_release(clients, count);
+}
+
+void server_init_reliable(void) {
+    if (!CreateTimerQueueTimer(&server.reliable_timer, nullptr, (WAITORTIMERCALLBACK)server_reliable_timer, nullptr, RELIABLE_INTERVAL, RELIABLE_INTERVAL, WT_EXECUTEDEFAULT)) {
+        console_error("Failed to create reliable UDP timer (%lu).", GetLastError());
+        server_stop();
+    }
 }
 
 void server_stop(void) {
+    if (server.reliable_timer)
+        DeleteTimerQueueTimer(nullptr, server.reliable_timer, INVALID_HANDLE_VALUE);
+    engine_cleanup(&server.engine);
+    udp_cleanup(&server.udp);
+    for (uint32_t i = 0; i < server.udp_worker_count; ++i) {
+        WaitForSingleObject(server.udp_workers[i], INFINITE);
+        CloseHandle(server.udp_workers[i]);
+    }
+    free(server.udp_workers);
     WSACleanup();
     http_server_cleanup();
 
-    hashtable_delete(&server.clients);
-    hashtable_delete(&server.clients_addr);
+    registry_delete(&server.clients);
+    rooms_delete(&server.rooms);
+    grid_delete(&server.grid);
+    compressor_cleanup(&server.compressor);
+    hashtable_delete(&server.rate_limits);
+    stats_cleanup(&server.stats);
 
     exit(EXIT_FAILURE);
 }
@@ -129,57 +357,118 @@ void server_listen_tcp(void) {
         }
 
         client_t *c = client_new(client_sock, client_addr);
-        if (!c) {
-            free(c);
+        if (!c)
             continue;
-        }
 
-        if (server.clients.pair_count > server.max_players)
+        if (server.clients.count > server.max_players)
             client_kick(c, "Server is full.");
     }
 }
 
 DWORD WINAPI server_listen_udp(unused void *arg) {
-    console_log("Listening on UDP port %d.", ntohs(server.udp_addr.sin_port));
+    udp_recv_t *receives[UDP_BATCH];
+    DWORD lens[UDP_BATCH];
+    uint32_t count;
+    while ((count = udp_wait(&server.udp, receives, lens))) {
+        for (uint32_t i = 0; i < count; ++i) {
+            udp_recv_t *recv = receives[i];
+            if (lens[i])
+                server_handle_datagram(recv->data, lens[i], recv->address);
+
+            if (!udp_post_recv(&server.udp, recv))
+                winsock_console_error();
+        }
+    }
+    return 0;
+}
+
+/// Run a shard's tick, logging what went wrong.
+static void server_tick_shard(scripting_api_t *shard) {
+    result_t res;
+    if (!(res = scripting_api_try_tick(shard, server.tick_dt)).is_ok) {
+        console_error(res.description);
+        result_discard(res);
+    }
+}
+
+void server_on_tick(scripting_api_t *shard) {
+    server_tick_shard(shard);
+    if (!InterlockedDecrement(&server.tick_pending))
+        SetEvent(server.tick_done);
+}
+
+DWORD WINAPI server_tick(unused void *arg) {
+    LARGE_INTEGER frequency, start, now;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+    int64_t period = frequency.QuadPart / server.tick_rate;
+    int64_t deadline = start.QuadPart + period;
+    int64_t last = start.QuadPart;
 
-    char *buffer = calloc(1, MAX_INTERMEDIATE_SIZE);
-    int len = SOCKET_ERROR;
+    // Sleep slices are far coarser than a tick without a high resolution timer
+    HANDLE timer = CreateWaitableTimerEx(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!timer)
+        timer = CreateWaitableTimer(nullptr, true, nullptr);
 
-    struct sockaddr_in addr;
-    int a_len = sizeof(addr);
     while (true) {
-        memset(buffer, 0, MAX_INTERMEDIATE_SIZE);
-        if ((len = recvfrom(server.udp_socket, buffer, MAX_INTERMEDIATE_SIZE, 0, (struct sockaddr *)&addr, &a_len)) == SOCKET_ERROR) {
-            winsock_console_error();
-            continue;
-        }
+        QueryPerformanceCounter(&start);
+        double dt = (double)(start.QuadPart - last) / frequency.QuadPart;
+        last = start.QuadPart;
 
-        // Look up client
-        void *ptr;
-        client_t *client;
-        char *addrf = address_string(addr);
-        if (!(ptr = hashtable_get(&server.clients_addr, addrf)) || !(client = *(client_t **)ptr))
-            continue;
-        free(addrf);
+        // Shards tick side by side on the engine's workers, this thread takes the first
+        server.tick_dt = dt;
+        server.tick_pending = scripting_shards.count - 1;
+        for (uint32_t i = 1; i < scripting_shards.count; ++i)
+            PostQueuedCompletionStatus(server.engine.port, 0, (ULONG_PTR)scripting_shards.list[i], &server.tick_io.overlapped);
+        server_tick_shard(scripting_shards.list[0]);
+        if (scripting_shards.count > 1)
+            WaitForSingleObject(server.tick_done, INFINITE);
 
-        if (!client || !client->account)
-            continue;
+        // Everything queued during the tick goes out as one write per client
+        uint32_t count = 0;
+        client_t **clients = client_snapshot(&count);
+        for (client_t **c = clients; c < clients + count; ++c)
+            client_flush_queue(*c);
+        client_snapshot_release(clients, count);
 
-        result_t res;
-        intermediate_t *intermediate = nullptr;
-        if (!(res = intermediate_from_buffer(buffer, len, &intermediate)).is_ok) {
-            console_error(res.description);
-            result_discard(res);
+        QueryPerformanceCounter(&now);
+        InterlockedIncrement64(&server.stats.ticks);
+        server.stats.tick_time = (double)(now.QuadPart - start.QuadPart) * 1000 / frequency.QuadPart;
+
+        // Running late, skip the missed ticks instead of trying to catch up
+        if (now.QuadPart >= deadline) {
+            InterlockedIncrement64(&server.stats.tick_overruns);
+            server.stats.tick_overrun = (double)(now.QuadPart - deadline) * 1000 / frequency.QuadPart;
+            deadline = now.QuadPart + period;
             continue;
         }
 
-        if (intermediate) {
-            if (!(res = scripting_api_try_event(&server.api, intermediate, client->uuid)).is_ok) {
-                console_error(res.description);
-                result_discard(res);
-            }
-        }
-        intermediate_delete(intermediate);
+        // Due times are relative and in 100 nanosecond intervals when negative
+        LARGE_INTEGER due = { .QuadPart = -(deadline - now.QuadPart) * 10000000 / frequency.QuadPart };
+        if (timer && SetWaitableTimer(timer, &due, 0, nullptr, nullptr, false))
+            WaitForSingleObject(timer, INFINITE);
+        else
+            Sleep((DWORD)((deadline - now.QuadPart) * 1000 / frequency.QuadPart));
+        deadline += period;
     }
+
     return 0;
 }
+
+void server_handle_datagram(char *buffer, int len, struct sockaddr_in address) {
+    client_t *client = client_find_address(address);
+    if (!client)
+        return;
+
+    // Reliable frames and acknowledgements take their own path
+    if (client->account && len > 0 && ((intermediate_control_e)*buffer == INTERMEDIATE_RELIABLE || (intermediate_control_e)*buffer == INTERMEDIATE_ACK)) {
+        client_on_reliable(client, buffer, len);
+        client_release(client);
+        return;
+    }
+
+    // Frames are read in place from the receive buffer, which isn't reposted until this returns
+    if (client->account && len > 0)
+        client_udp_receive(client, buffer, len);
+    client_release(client);
+}
@@ -4,26 +4,91 @@
 #include "../api/scripting_api.h"
 #include "../data/hashtable.h"
 #include "http.h"
+#include "engine.h"
+#include "stats.h"
+#include "udp.h"
+#include "registry.h"
+#include "rooms.h"
+#include "grid.h"
+#include "compress.h"
+#include "../data/ratelimit.h"
 
 #define SERVER_DEFAULT_PORT 5060
 
+#define SERVER_DEFAULT_SEND_QUEUE 256
+
+/// What happens to packets sent to a client whose queue is full.
+typedef enum slow_policy_e {
+    SLOW_POLICY_DROP,
+    SLOW_POLICY_CONFLATE,
+    SLOW_POLICY_DISCONNECT,
+} slow_policy_e;
+
+/// What happens to events that arrive over a client's rate limit.
+typedef enum rate_policy_e {
+    RATE_POLICY_DROP,
+    RATE_POLICY_DEFER,
+} rate_policy_e;
+
 typedef struct server_t {
     uint32_t max_players;
 
     SOCKET tcp_socket, udp_socket;
     struct sockaddr_in tcp_addr, udp_addr;
-    HANDLE udp_thread;
+    uint32_t udp_worker_count;
+    HANDLE *udp_workers;
+    udp_t udp;
+    engine_t engine;
 
     bool login;
     scripting_api_t api;
-    hashtable_t clients, clients_addr;
+    registry_t clients;
+    rooms_t rooms;
+    grid_t grid;
+
+    // Rate limiting, buckets are copied into every client
+    ratelimit_t rate_limit;
+    hashtable_t rate_limits;
+    rate_policy_e rate_policy;
+
+    // Outbound queues
+    uint32_t send_queue;
+    slow_policy_e slow_policy;
+
+    compressor_t compressor;
+
+    // Tick scheduler, a rate of 0 sends packets immediately
+    uint32_t tick_rate;
+    HANDLE tick_thread;
+    // Shards past the first tick on the engine's workers, the last to finish sets tick_done
+    engine_io_t tick_io;
+    double tick_dt;
+    volatile LONG tick_pending;
+    HANDLE tick_done;
+
+    // Retransmits unacknowledged reliable packets
+    HANDLE reliable_timer;
+
+    stats_t stats;
 } server_t;
 extern server_t server;
 
 void server_start(void);
 void server_init_tcp(void);
 void server_init_udp(void);
+void server_init_rate_limits(void);
+void server_init_send_queues(void);
+void server_init_tick(void);
+void server_init_grid(void);
+void server_init_compression(void);
+void server_init_reliable(void);
 void server_stop(void);
 
 void server_listen_tcp(void);
-DWORD WINAPI server_listen_udp(unused void *arg);
\ No newline at end of file
+DWORD WINAPI server_listen_udp(unused void *arg);
+/// Tick loop, runs net.events.tick and flushes every client at a fixed rate.
+DWORD WINAPI server_tick(unused void *arg);
+/// Called by the engine to run a shard's part of a tick.
+void server_on_tick(scripting_api_t *shard);
+/// Validate a datagram and dispatch it for the client it came from.
+void server_handle_datagram(char *buffer, int len, struct sockaddr_in address);
\ No newline at end of file
@@ -0,0 +1,22 @@
+#include "stats.h"
+
+void stats_init(stats_t *self) {
+    *self = (stats_t) {
+        .rate_limited = 0,
+        .rate_limited_events = hashtable_string(),
+    };
+}
+
+void stats_cleanup(stats_t *self) {
+    hashtable_delete(&self->rate_limited_events);
+}
+
+void stats_count(hashtable_t *table, const char *key, uint64_t amount) {
+    mutex_lock(table->mutex);
+    uint64_t *count = hashtable_get(table, (void *)key);
+    if (count)
+        *count += amount;
+    else
+        hashtable_insert(table, (void *)key, &amount, sizeof(uint64_t));
+    mutex_release(table->mutex);
+}
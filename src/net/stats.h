@@ -0,0 +1,53 @@
+#pragma once
+#include "../util/win32.h"
+#include "../data/hashtable.h"
+#include <stdint.h>
+
+/// Key of rate_limited_events counting every event type without a limit of its own.
+#define STATS_OTHER_EVENTS "other"
+
+/// Server wide counters, exposed to scripts through net.stats.
+typedef struct stats_t {
+    // Rate limiting
+    volatile LONG64 rate_limited;
+    hashtable_t rate_limited_events;
+
+    // Outbound queues
+    volatile LONG64 send_dropped;
+    volatile LONG64 send_conflated;
+    volatile LONG64 slow_disconnects;
+
+    // Datagrams dropped because too many of a client's were waiting to be dispatched
+    volatile LONG64 udp_dropped;
+
+    // Bundles sent, and the packets that went out inside them
+    volatile LONG64 bundles;
+    volatile LONG64 bundled;
+
+    // Reliable UDP, retransmitted counts every resend of a packet
+    volatile LONG64 reliable_sent;
+    volatile LONG64 reliable_retransmitted;
+
+    // Delta encoding, saved is in bytes compared to full intermediates
+    volatile LONG64 delta_packets;
+    volatile LONG64 delta_saved;
+
+    // Compression, bytes in and out cover every frame considered, time is in performance counter ticks
+    volatile LONG64 compressed;
+    volatile LONG64 compress_in;
+    volatile LONG64 compress_out;
+    volatile LONG64 compress_time;
+
+    // Tick scheduler, times are of the latest tick in milliseconds
+    volatile LONG64 ticks;
+    volatile LONG64 tick_overruns;
+    double tick_time, tick_overrun;
+} stats_t;
+
+/// Create the counters.
+void stats_init(stats_t *self);
+/// Clean up after the counters.
+void stats_cleanup(stats_t *self);
+
+/// Add to a counter in a table of per-key uint64_t counters.
+void stats_count(hashtable_t *table, const char *key, uint64_t amount);
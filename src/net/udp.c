@@ -0,0 +1,91 @@
+#include "udp.h"
+#include <malloc.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+result_t udp_init(udp_t *self, SOCKET socket, uint32_t workers) {
+    InitializeSListHead(&self->free_sends);
+    self->socket = socket;
+    if (!(self->port = CreateIoCompletionPort((HANDLE)socket, nullptr, 0, workers)))
+        return result_error("Failed to create UDP completion port (%lu).", GetLastError());
+
+    self->receive_count = UDP_BATCH * workers;
+    self->receives = calloc(self->receive_count, sizeof(udp_recv_t));
+    for (udp_recv_t *recv = self->receives; recv < self->receives + self->receive_count; ++recv) {
+        if (!udp_post_recv(self, recv))
+            return result_error("Failed to post UDP receive (%d).", WSAGetLastError());
+    }
+
+    return result_ok();
+}
+
+void udp_cleanup(udp_t *self) {
+    if (self->port)
+        CloseHandle(self->port);
+
+    SLIST_ENTRY *entry;
+    while ((entry = InterlockedPopEntrySList(&self->free_sends)))
+        _aligned_free((char *)entry - offsetof(udp_send_t, entry));
+    free(self->receives);
+}
+
+bool udp_post_recv(udp_t *self, udp_recv_t *recv) {
+    recv->io = (engine_io_t) { .op = ENGINE_OP_RECV };
+    recv->buffer = (WSABUF) { .len = MAX_INTERMEDIATE_SIZE, .buf = recv->data };
+    recv->flags = 0;
+    recv->address_len = sizeof(recv->address);
+
+    if (WSARecvFrom(self->socket, &recv->buffer, 1, nullptr, &recv->flags, (struct sockaddr *)&recv->address, &recv->address_len, &recv->io.overlapped, nullptr) == SOCKET_ERROR
+        && WSAGetLastError() != WSA_IO_PENDING)
+        return false;
+    return true;
+}
+
+void udp_send(udp_t *self, const struct sockaddr_in *address, packet_t *packet) {
+    SLIST_ENTRY *entry = InterlockedPopEntrySList(&self->free_sends);
+    udp_send_t *send = entry
+        ? (udp_send_t *)((char *)entry - offsetof(udp_send_t, entry))
+        : _aligned_malloc(sizeof(udp_send_t), MEMORY_ALLOCATION_ALIGNMENT);
+
+    send->io = (engine_io_t) { .op = ENGINE_OP_SEND };
+    send->buffer = (WSABUF) { .len = packet->len, .buf = packet->data };
+    send->packet = packet;
+
+    if (WSASendTo(self->socket, &send->buffer, 1, nullptr, 0, (const struct sockaddr *)address, sizeof(struct sockaddr_in), &send->io.overlapped, nullptr) == SOCKET_ERROR
+        && WSAGetLastError() != WSA_IO_PENDING) {
+        packet_release(packet);
+        InterlockedPushEntrySList(&self->free_sends, &send->entry);
+    }
+}
+
+uint32_t udp_wait(udp_t *self, udp_recv_t *out[UDP_BATCH], DWORD lens[UDP_BATCH]) {
+    OVERLAPPED_ENTRY entries[UDP_BATCH];
+    ULONG count = 0;
+    uint32_t received = 0;
+
+    while (!received) {
+        if (!GetQueuedCompletionStatusEx(self->port, entries, UDP_BATCH, &count, INFINITE, false))
+            return 0;
+
+        for (OVERLAPPED_ENTRY *entry = entries; entry < entries + count; ++entry) {
+            engine_io_t *io = (engine_io_t *)entry->lpOverlapped;
+            switch (io->op) {
+                case ENGINE_OP_RECV:
+                    out[received] = (udp_recv_t *)io;
+                    lens[received++] = entry->dwNumberOfBytesTransferred;
+                    break;
+
+                case ENGINE_OP_SEND: {
+                    udp_send_t *send = (udp_send_t *)io;
+                    packet_release(send->packet);
+                    InterlockedPushEntrySList(&self->free_sends, &send->entry);
+                    break;
+                }
+
+                default: break;
+            }
+        }
+    }
+
+    return received;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "../util/win32.h"
+#include "../data/result.h"
+#include "../api/intermediate.h"
+#include "engine.h"
+#include "packet.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Amount of receives kept pending per worker, and completions dequeued per wait.
+#define UDP_BATCH 64
+
+/// A pending overlapped receive and the datagram it fills.
+typedef struct udp_recv_t {
+    engine_io_t io;
+    WSABUF buffer;
+    DWORD flags;
+    struct sockaddr_in address;
+    int address_len;
+    char data[MAX_INTERMEDIATE_SIZE];
+} udp_recv_t;
+
+/// A pending overlapped send, recycled through a lock free list.
+typedef struct udp_send_t {
+    engine_io_t io;
+    SLIST_ENTRY entry;
+    WSABUF buffer;
+    packet_t *packet;
+} udp_send_t;
+
+/// Batched UDP socket, receives and sends complete on a dedicated completion port.
+/// Any amount of workers may wait on the port at once.
+typedef struct udp_t {
+    SLIST_HEADER free_sends;
+    SOCKET socket;
+    HANDLE port;
+    udp_recv_t *receives;
+    uint32_t receive_count;
+} udp_t;
+
+/// Attach a bound socket to a new completion port and post UDP_BATCH receives per worker.
+result_t udp_init(udp_t *self, SOCKET socket, uint32_t workers);
+void udp_cleanup(udp_t *self);
+
+/// Post an overlapped receive, returns false if the socket failed.
+bool udp_post_recv(udp_t *self, udp_recv_t *recv);
+/// Post an overlapped send of a packet, taking ownership of one reference to it.
+/// Never blocks, the packet is released once the send completes.
+void udp_send(udp_t *self, const struct sockaddr_in *address, packet_t *packet);
+
+/// Wait for up to UDP_BATCH completions, recycling finished sends.
+/// Completed receives are written to out, returns how many there are.
+/// Returns 0 if the port was closed.
+uint32_t udp_wait(udp_t *self, udp_recv_t *out[UDP_BATCH], DWORD lens[UDP_BATCH]);
@@ -0,0 +1,80 @@
+// Registry regression test, cycles clients through enough inserts and removals to rebuild the indices
+// and checks every live client is still found by handle, uuid and address.
+#include "../src/net/client.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_LIVE 40
+#define TEST_CYCLES 2000
+
+// The registry only retains what it hands out, so retaining is all it needs from client.c
+void client_retain(client_t *self) {
+    self->references++;
+}
+
+static int failures = 0;
+
+static void check(bool condition, const char *what, int index) {
+    if (condition)
+        return;
+    printf("FAIL: %s (client %d)\n", what, index);
+    failures++;
+}
+
+static client_t *test_client(int id) {
+    client_t *client = calloc(1, sizeof(client_t));
+    client->uuid = malloc(UUID_LENGTH + 1);
+    snprintf(client->uuid, UUID_LENGTH + 1, "client%010d", id);
+    client->address.sin_addr.s_addr = 0x0100007f;
+    client->address.sin_port = (unsigned short)(1000 + id);
+    return client;
+}
+
+static void test_find_all(registry_t *registry, client_t **live, int count) {
+    for (int i = 0; i < count; ++i) {
+        check(registry_get(registry, live[i]->handle) == live[i], "found by handle", i);
+        check(registry_find_uuid(registry, live[i]->uuid) == live[i], "found by uuid", i);
+        check(registry_find_address(registry, live[i]->address) == live[i], "found by address", i);
+    }
+}
+
+int main(void) {
+    registry_t registry = registry_new();
+    client_t *live[TEST_LIVE];
+    int id = 0;
+
+    for (int i = 0; i < TEST_LIVE; ++i)
+        registry_insert(&registry, live[i] = test_client(id++));
+
+    // Every cycle leaves a tombstone in both indices, so they are rebuilt many times over
+    for (int cycle = 0; cycle < TEST_CYCLES; ++cycle) {
+        int i = cycle % TEST_LIVE;
+        client_t *gone = live[i];
+        registry_remove(&registry, gone->handle);
+        check(registry_get(&registry, gone->handle) == nullptr, "stale handle", i);
+        check(registry_find_uuid(&registry, gone->uuid) == nullptr, "removed uuid", i);
+        check(registry_find_address(&registry, gone->address) == nullptr, "removed address", i);
+
+        registry_insert(&registry, live[i] = test_client(id++));
+        free(gone->uuid);
+        free(gone);
+        test_find_all(&registry, live, TEST_LIVE);
+    }
+
+    // Then drain it, which must leave nothing reachable
+    for (int i = 0; i < TEST_LIVE; ++i) {
+        registry_remove(&registry, live[i]->handle);
+        check(registry_find_address(&registry, live[i]->address) == nullptr, "drained address", i);
+        test_find_all(&registry, live + i + 1, TEST_LIVE - i - 1);
+    }
+    check(registry.count == 0, "empty after draining", 0);
+
+    for (int i = 0; i < TEST_LIVE; ++i) {
+        free(live[i]->uuid);
+        free(live[i]);
+    }
+    registry_delete(&registry);
+
+    printf("%s\n", failures ? "registry test failed" : "registry test passed");
+    return failures != 0;
+}